@@ -9,6 +9,18 @@
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/random.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+  #include <immintrin.h>
+#endif
 
 typedef enum {false, true} Boolean;
 
@@ -16,511 +28,4539 @@ typedef enum {false, true} Boolean;
 #define wrlock pthread_rwlock_wrlock
 #define rwlunlock pthread_rwlock_unlock
 
-// Di seguito sono definite alcune funzioni di hashing diverse.
-// Viene utilizzata quella indicata con il define
+// Accessi atomici ai campi letti dai lettori senza lock
+#define load_relaxed(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_relaxed(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
 
-#define hash_value hash_value_FNV1a
+// Di seguito sono definite alcune funzioni di hashing diverse.
+// Ogni tabella usa quella impostata con hash_set_hash_function,
+// inizializzata con un seme casuale proprio della tabella
 
 #define FNV_OFFSET 14695981039346656037UL
 #define FNV_PRIME 1099511628211UL
 
-size_t hash_value_FNV1a(HashTable* ht, char* key) {
-    size_t hash = FNV_OFFSET;
-    char* p;
+size_t hash_fnv1a(const char* key, size_t len, size_t seed) {
+    size_t hash = FNV_OFFSET ^ seed;
+    size_t i;
 
-    for (p = key; *p; p++) {
+    for (i = 0; i < len; i++) {
         hash *= FNV_PRIME;
-        hash ^= (size_t)(unsigned char)(*p);
+        hash ^= (size_t)(unsigned char)key[i];
     }
 
-    return hash % ht->size;
+    return hash;
 }
 
-size_t hash_value_sdbm(HashTable* ht, char* key) {
-        size_t hash = 0;
+size_t hash_sdbm(const char* key, size_t len, size_t seed) {
+        size_t hash = seed;
         size_t counter;
 
-        for (counter = 0; key[counter] != '\0'; counter++) {
+        for (counter = 0; counter < len; counter++) {
                 hash = key[counter] + (hash << 6) + (hash << 16) - hash;
         }
 
-        return hash % ht->size;
+        return hash;
 }
 
-size_t hash_value_djb2(HashTable* ht, char* key) {
-        size_t hash = 5381;
+size_t hash_djb2(const char* key, size_t len, size_t seed) {
+        size_t hash = 5381 ^ seed;
         size_t counter;
 
-        for (counter = 0; key[counter] != '\0'; counter++) {
+        for (counter = 0; counter < len; counter++) {
                 hash = ((hash << 5) + hash) + key[counter];
         }
 
-        return hash % ht->size;
+        return hash;
 }
 
-#define TABLE_MAX_LOAD 70
-#define TABLE_MIN_LOAD 30
+/*
+ * Funzione della famiglia di wyhash: la chiave viene letta 8 byte alla
+ * volta (16 per iterazione, 48 per le chiavi lunghe su tre catene
+ * indipendenti) e ogni coppia di parole viene combinata con il seme
+ * tramite una moltiplicazione a 128 bit. Le chiavi fino a 16 byte sono
+ * lette con al più quattro accessi sovrapposti, senza cicli.
+ */
+__extension__ typedef unsigned __int128 uint128;
 
-HashTable* create_hash_table(size_t size) {
-        HashTable* ht;
+#define WY_P0 0xa0761d6478bd642fUL
+#define WY_P1 0xe7037ed1a0b428dbUL
+#define WY_P2 0x8ebc6af09c88c6e3UL
+#define WY_P3 0x589965cc75374cc3UL
+
+static inline
+uint64_t wy_mix(uint64_t a, uint64_t b) {
+        uint128 r = (uint128) a * b;
+
+        return (uint64_t) r ^ (uint64_t) (r >> 64);
+}
+
+static inline
+uint64_t wy_read8(const unsigned char* p) {
+        uint64_t v;
+
+        memcpy(&v, p, sizeof(v));
+        return v;
+}
+
+static inline
+uint64_t wy_read4(const unsigned char* p) {
+        uint32_t v;
+
+        memcpy(&v, p, sizeof(v));
+        return v;
+}
+
+size_t hash_wyhash(const char* key, size_t len, size_t seed) {
+        const unsigned char* p = (const unsigned char*) key;
+        uint64_t see1, see2;
+        uint64_t a, b;
+        uint128 r;
         size_t i;
 
-        // Controllo che la dimensione non sia troppo grande
-        // e quindi faccia overflow
-        if (size + size < size) {
-                perror("Dimensione troppo grande");
-                return NULL;
-        }
+        seed ^= wy_mix(seed ^ WY_P0, WY_P1);
 
-        if (size == 0) {
-                perror("Dimensione troppo piccola");
-                return NULL;
+        if (len <= 16) {
+                if (len >= 4) {
+                        // Due letture da 4 byte dall'inizio e due dalla fine
+                        a = (wy_read4(p) << 32) |
+                            wy_read4(p + ((len >> 3) << 2));
+                        b = (wy_read4(p + len - 4) << 32) |
+                            wy_read4(p + len - 4 - ((len >> 3) << 2));
+                } else if (len > 0) {
+                        a = ((uint64_t) p[0] << 16) |
+                            ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+                        b = 0;
+                } else {
+                        a = b = 0;
+                }
+        } else {
+                i = len;
+                if (i > 48) {
+                        see1 = seed;
+                        see2 = seed;
+                        do {
+                                seed = wy_mix(wy_read8(p) ^ WY_P1,
+                                              wy_read8(p + 8) ^ seed);
+                                see1 = wy_mix(wy_read8(p + 16) ^ WY_P2,
+                                              wy_read8(p + 24) ^ see1);
+                                see2 = wy_mix(wy_read8(p + 32) ^ WY_P3,
+                                              wy_read8(p + 40) ^ see2);
+                                p += 48;
+                                i -= 48;
+                        } while (i > 48);
+                        seed ^= see1 ^ see2;
+                }
+                while (i > 16) {
+                        seed = wy_mix(wy_read8(p) ^ WY_P1,
+                                      wy_read8(p + 8) ^ seed);
+                        p += 16;
+                        i -= 16;
+                }
+                // Gli ultimi 16 byte, eventualmente sovrapposti ai precedenti
+                a = wy_read8(p + i - 16);
+                b = wy_read8(p + i - 8);
         }
 
-        // Alloco prima lo spazio per la HashTable stessa
-        ht = malloc(sizeof(HashTable));
-        if (ht == NULL) {
-                perror("Errore durante l'allocazione della HashTable");
-                return NULL;
-        }
-        
-        // Alloco lo spazio per i singoli nodi
-        ht->node = calloc(size, sizeof(Node));
-        if (ht->node == NULL) {
-                free(ht);
-                perror("Errore durante l'allocazione dei nodi");
-                return NULL;
-        }
+        r = (uint128) (a ^ WY_P1) * (b ^ seed);
+        a = (uint64_t) r;
+        b = (uint64_t) (r >> 64);
 
-        // Inizializzo i nodi
-        for (i = 0; i < size; i++) {
-                ht->node[i].key = NULL;
-                ht->node[i].element = EMPTY;
-        }
+        return wy_mix(a ^ WY_P0 ^ len, b ^ WY_P1);
+}
 
-        // Inizializzo il lock
-        pthread_rwlock_init(&ht->lock, NULL);
+// Funzione usata dalle nuove tabelle e da hash_value
+#define DEFAULT_HASH_FUNCTION hash_wyhash
 
-        // Inizializzo gli altri membri della struct
-        ht->size = size;
-        ht->num_elements = 0;
-        ht->high_density = TABLE_MAX_LOAD;
-        ht->low_density = TABLE_MIN_LOAD;
+size_t hash_value(char* key) {
+        return hash_value_n(key, strlen(key));
+}
 
-        return ht;
+size_t hash_value_n(const void* key, size_t len) {
+        return DEFAULT_HASH_FUNCTION(key, len, 0);
 }
 
+#define TABLE_MAX_LOAD 70
+#define TABLE_MIN_LOAD 30
+
+// Percentuale di TOMBSTONE oltre la quale uno shard viene ricostruito
+// alla stessa dimensione, e percentuale minima di nodi EMPTY che la
+// ricostruzione garantisce qualunque siano le densità impostate
+#define TABLE_MAX_TOMBSTONES 20
+#define TABLE_MIN_EMPTY 5
+
+// Numero minimo di elementi nel limbo di uno shard
+#define LIMBO_RECLAIM 128
+
+// Nodi dell'array vecchio spostati da ogni inserimento o rimozione
+// durante un ridimensionamento incrementale
+#define MIGRATE_STEP 64
+
+// Granularità delle classi dell'arena, dimensione massima di un blocco
+// servito dall'arena e dimensioni minima e massima di una slab
+#define ARENA_ALIGN 16
+#define ARENA_MAX (ARENA_ALIGN * HASH_ARENA_CLASSES)
+#define ARENA_SLAB_MIN 4096
+#define ARENA_SLAB_MAX (1 << 20)
+
 /*
- * Questa funzione è il cuore dell'intera HashTable: utilizza il meccanismo
- * di LINEAR PROBING per trovare un nodo non NULL, spostandosi a destra di
- * una posizione ogni volta che ne incontra uno.
+ * Arena di uno shard: i blocchi vengono ritagliati in sequenza da slab di
+ * dimensione crescente, collegate tra loro dai primi byte, e quelli
+ * liberati vengono riusati tramite una lista per classe di dimensione,
+ * collegata anch'essa dai primi byte dei blocchi. Viene usata solo sotto
+ * il write lock dello shard. I blocchi più grandi di ARENA_MAX vengono
+ * allocati singolarmente, preceduti da un'intestazione che li collega in
+ * una lista doppia, così che la distruzione possa liberarli senza visitare
+ * i nodi. I blocchi richiesti ad arena disabilitata passano per malloc:
+ * arena_size ne restituisce 0, così che vengano liberati con free.
  */
+typedef struct arena_large {
+        struct arena_large* prev;
+        struct arena_large* next;
+} ArenaLarge;
+
+static inline
+size_t arena_size(HashShard* shard, size_t size) {
+        if (shard->arena == NULL || !shard->arena->enabled) {
+                return 0;
+        }
+        return (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+}
+
 static
-Node* find_node(Node* node, size_t hash, char* key, size_t ht_size) {
-        Node* found = NULL;
-        size_t counter = 0;
+void* arena_alloc(HashShard* shard, size_t size) {
+        HashArena* arena = shard->arena;
+        size_t chunk = arena_size(shard, size);
+        size_t slab_size;
+        ArenaLarge* large;
+        void** head;
+        char* slab;
 
-        for (; counter < ht_size; counter++, hash = (hash + 1) % ht_size) {
-                // Controllo che il nodo non sia NULL
-                if (node[hash].key == NULL) {
-                        if (node[hash].element == EMPTY) {
-                                // Se l'elemento è EMPTY allora è libero
-                                // per l'assegnazione
-                                return found != NULL ? found : &node[hash];
-                        }
-                        // Altrimenti il nodo è una TOMBSTONE, cioè un nodo
-                        // rimosso in precedenza
-                        if (found == NULL) {
-                                // Lo salviamo per il caso in cui questa
-                                // funzione venga usata da hash_insert,
-                                // cioè per la ricerca di un nodo NULL
-                                found = &node[hash];
-                        }
-                        continue;
+        if (chunk == 0) {
+                return malloc(size);
+        }
+
+        if (chunk > ARENA_MAX) {
+                large = malloc(ARENA_ALIGN + chunk);
+                if (large == NULL) {
+                        return NULL;
+                }
+                large->prev = NULL;
+                large->next = arena->large;
+                if (arena->large != NULL) {
+                        ((ArenaLarge*) arena->large)->prev = large;
                 }
+                arena->large = large;
+                return (char*) large + ARENA_ALIGN;
+        }
 
-                // Qualora non sia vuoto confronto la chiave presente con
-                // quella fornita
-                if (strcmp(key, node[hash].key) == 0) {
-                        LOG(("Trovato alla pos. %lu\n", hash));
-                        return &node[hash];
+        // Riuso un blocco liberato della stessa classe, se presente
+        head = &arena->free_list[chunk / ARENA_ALIGN - 1];
+        if (*head != NULL) {
+                slab = *head;
+                *head = *(void**) slab;
+                return slab;
+        }
+
+        // Altrimenti lo ritaglio dalla slab corrente, allocandone una
+        // nuova grande il doppio se non c'è più spazio
+        if (arena->slab == NULL || arena->used + chunk > arena->slab_size) {
+                slab_size = arena->slab_size * 2;
+                if (slab_size < ARENA_SLAB_MIN) {
+                        slab_size = ARENA_SLAB_MIN;
+                }
+                if (slab_size > ARENA_SLAB_MAX) {
+                        slab_size = ARENA_SLAB_MAX;
                 }
+                slab = malloc(slab_size);
+                if (slab == NULL) {
+                        return NULL;
+                }
+                *(char**) slab = arena->slab;
+                arena->slab = slab;
+                arena->slab_size = slab_size;
+                arena->used = ARENA_ALIGN;
         }
 
-        // Nel caso in cui il ciclo sopra termini significa che non è
-        // presente l'elemento all'interno della HashTable
-        return NULL;
+        slab = arena->slab + arena->used;
+        arena->used += chunk;
+        return slab;
 }
 
-static
-int insert(Node* node, size_t hash, char* key, void* element, size_t ht_size) {
-        size_t counter = 0;
+static inline
+void arena_free(HashShard* shard, void* ptr, size_t chunk) {
+        ArenaLarge* large;
+        void** head;
 
-        for (; counter < ht_size; counter++, hash = (hash + 1) % ht_size) {
-                if (node[hash].key == NULL) {
-                        // Se il nodo è NULL o la chiave è NULL lo tratto
-                        // come EMPTY e inscrivo i valori
-                        LOG(("Inserting %s (at %ld) with '%s' key\n",
-                                (char *) element, hash, key));
-                        // Effettuo una copia del valore contenuto
-                        // all'interno del puntatore
-                        node[hash].key = strdup(key);
-                        node[hash].element = strdup(element);
-                        return 1;
+        if (chunk == 0) {
+                free(ptr);
+                return;
+        }
+        if (chunk > ARENA_MAX) {
+                large = (ArenaLarge*) ((char*) ptr - ARENA_ALIGN);
+                if (large->prev != NULL) {
+                        large->prev->next = large->next;
+                } else {
+                        shard->arena->large = large->next;
                 }
-                if (strcmp(key, node[hash].key) == 0) {
-                        // Se il nodo è popolato si tratta di un tentativo
-                        // di sovrascrittura
-                        LOG(("Updating '%s' (at %ld) with %s element\n",
-                                key, hash, (char *) element));
-                        free(node[hash].element);
-                        node[hash].element = strdup(element);
-                        return 0;
+                if (large->next != NULL) {
+                        large->next->prev = large->prev;
                 }
+                free(large);
+                return;
         }
-        return -1;
+        head = &shard->arena->free_list[chunk / ARENA_ALIGN - 1];
+        *(void**) ptr = *head;
+        *head = ptr;
 }
 
 /*
- * Questa funzione viene chiamata quando la dimensione della HashTable
- * supera il limite fissato. Raddoppia le dimensioni della stessa
- * ed effettua una copia dei nodi inserendoli con hash aggiornato alle
- * nuove dimensioni.
+ * Libera tutte le slab dell'arena, i blocchi grandi e l'arena stessa.
  */
 static
-Boolean hash_expand(HashTable* ht) {
-        Node* copy;
-        size_t doubled;
-        size_t i;
-        size_t hash;
-        size_t original_size = ht->size;
-
+void arena_destroy(HashArena* arena) {
+        ArenaLarge* large;
+        char* slab;
 
-        // Raddoppio le dimensioni della HashTable attuale
-        // e controllo che non siano troppo grandi
-        doubled = ht->size * 2;
-        if (doubled + doubled < doubled) {
-                return false;
+        if (arena == NULL) {
+                return;
         }
-
-        // Alloco un nuovo array di nodi con dimensione doppia
-        copy = calloc(doubled, sizeof(Node));
-        if (copy == NULL) {
-                return false;
+        while (arena->large != NULL) {
+                large = arena->large;
+                arena->large = large->next;
+                free(large);
         }
-
-        for (i = 0; i < doubled; i++) {
-                copy[i].key = NULL;
-                copy[i].element = EMPTY;
+        while (arena->slab != NULL) {
+                slab = arena->slab;
+                arena->slab = *(char**) slab;
+                free(slab);
         }
+        free(arena);
+}
 
-        // Assegno la nuova dimensione alla HashTable
-        // (necessario per utilizzare correttamente la funzione di hash)
-        ht->size = doubled;
+/*
+ * Epoch-based reclamation: ogni thread lettore annuncia l'epoca globale in
+ * cui è entrato in un proprio record, allineato alla linea di cache, e non
+ * scrive altra memoria condivisa. La memoria rimossa da uno shard viene
+ * messa nel suo limbo e liberata solo dopo che l'epoca globale è avanzata
+ * due volte, cioè quando nessun lettore può ancora riferirla.
+ */
+typedef struct epoch_record {
+        _Alignas(HASH_CACHE_LINE) unsigned long epoch;
+        int in_use;
+        struct epoch_record* next;
+} EpochRecord;
 
-        // Resetto il numero di elementi
-        ht->num_elements = 0;
+// Le epoche sono pari, il bit meno significativo indica un lettore attivo
+#define EPOCH_ACTIVE 1UL
+#define EPOCH_STEP 2UL
 
-        // Inserisco nodo per nodo quelli non nulli all'interno del
-        // nuovo array di dimensioni raddoppiate, utilizzando la funzione
-        // d'insert, e libero la memoria allocata per i nodi originali.
-        for (i = 0; i < original_size; i++) {
-                if (ht->node[i].key != NULL) {
-                        hash = hash_value(ht, ht->node[i].key);
-                        if (insert(copy,
-                                   hash,
-                                   ht->node[i].key,
-                                   ht->node[i].element,
-                                   ht->size) == 1) {
-                                ht->num_elements++;
-                        }
-                        free(ht->node[i].key);
-                        free(ht->node[i].element);
-                }
-        }
-        // Assegno l'array di nodi raddoppiati alla HashTable
-        free(ht->node);
-        ht->node = copy;
+static unsigned long global_epoch = EPOCH_STEP;
+static EpochRecord* epoch_records = NULL;
+static pthread_key_t epoch_key;
+static pthread_once_t epoch_once = PTHREAD_ONCE_INIT;
+static _Thread_local EpochRecord* epoch_self = NULL;
+static _Thread_local unsigned int epoch_nesting = 0;
 
-        return true;
+/*
+ * Chiamata alla terminazione di un thread: rende il suo record
+ * riutilizzabile da un altro thread.
+ */
+static
+void epoch_release(void* record) {
+        EpochRecord* r = record;
+
+        store_release(&r->epoch, 0);
+        store_release(&r->in_use, 0);
+}
+
+static
+void epoch_init(void) {
+        pthread_key_create(&epoch_key, epoch_release);
 }
 
 /*
- * Questa funzione viene chiamata quando la dimensione della HashTable
- * cala sotto il limite fissato. Dimezza le dimensioni della stessa
- * ed effettua una copia dei nodi inserendoli con hash aggiornato alle
- * nuove dimensioni.
+ * Restituisce il record del thread chiamante, riutilizzandone uno libero
+ * oppure allocandone uno nuovo e aggiungendolo in testa alla lista.
  */
 static
-Boolean hash_shrink(HashTable* ht) {
-        Node* copy;
-        size_t half;
-        size_t i;
-        size_t hash;
-        size_t original_size = ht->size;
+EpochRecord* epoch_record(void) {
+        EpochRecord* r;
+        int free_slot;
 
-
-        // Raddoppio le dimensioni della HashTable attuale
-        // e controllo che non siano troppo piccole
-        half = ht->size / 2;
-        if (half < 1) {
-                return false;
+        if (epoch_self != NULL) {
+                return epoch_self;
         }
 
-        // Alloco un nuovo array di nodi con dimensione dimezzata
-        copy = calloc(half, sizeof(Node));
-        if (copy == NULL) {
-                return false;
+        pthread_once(&epoch_once, epoch_init);
+
+        for (r = load_acquire(&epoch_records); r != NULL; r = r->next) {
+                free_slot = 0;
+                if (load_relaxed(&r->in_use) == 0 &&
+                    __atomic_compare_exchange_n(&r->in_use, &free_slot, 1, 0,
+                                                __ATOMIC_ACQ_REL,
+                                                __ATOMIC_RELAXED)) {
+                        break;
+                }
         }
 
-        for (i = 0; i < half; i++) {
-                copy[i].key = NULL;
-                copy[i].element = EMPTY;
+        if (r == NULL) {
+                r = aligned_alloc(HASH_CACHE_LINE, sizeof(EpochRecord));
+                if (r == NULL) {
+                        perror("Errore durante l'allocazione del record");
+                        abort();
+                }
+                r->epoch = 0;
+                r->in_use = 1;
+                r->next = load_relaxed(&epoch_records);
+                while (!__atomic_compare_exchange_n(&epoch_records, &r->next,
+                                                    r, 0,
+                                                    __ATOMIC_RELEASE,
+                                                    __ATOMIC_RELAXED)) {
+                }
         }
 
-        // Assegno la nuova dimensione alla HashTable
-        // (necessario per utilizzare correttamente la funzione di hash)
-        ht->size = half;
+        pthread_setspecific(epoch_key, r);
+        epoch_self = r;
+        return r;
+}
 
-        // Resetto il numero di elementi
-        ht->num_elements = 0;
+void hash_epoch_enter(void) {
+        EpochRecord* r;
 
-        // Inserisco nodo per nodo quelli non nulli all'interno del
-        // nuovo array di dimensioni dimezzate, utilizzando la funzione
-        // d'insert, e libero la memoria allocata per i nodi originali.
-        for (i = 0; i < original_size; i++) {
-                if (ht->node[i].key != NULL) {
-                        hash = hash_value(ht, ht->node[i].key);
-                        if (insert(copy,
-                                   hash,
-                                   ht->node[i].key,
-                                   ht->node[i].element,
-                                   ht->size) == 1) {
-                                ht->num_elements++;
-                        }
-                        free(ht->node[i].key);
-                        free(ht->node[i].element);
-                }
+        if (epoch_nesting++ > 0) {
+                return;
         }
-        // Assegno l'array di nodi dimezzati alla HashTable
-        free(ht->node);
-        ht->node = copy;
 
-        return true;
+        r = epoch_record();
+        __atomic_store_n(&r->epoch,
+                         load_relaxed(&global_epoch) | EPOCH_ACTIVE,
+                         __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void hash_epoch_exit(void) {
+        if (epoch_nesting == 0 || --epoch_nesting > 0) {
+                return;
+        }
+
+        store_release(&epoch_self->epoch, 0);
 }
 
 /*
- * Questa funzione agisce da wrapper della funzione d'inserimento.
- * Controlla che la chiave e l'elemento non siano nulli, in caso
- * contrario ritorna -1; controlla che la dimensione della HashTable
- * non superi il limite superiore fissato, ridimensionandola in tal caso;
- * e utilizza la write lock per effettuare l'inserimento.
+ * Avanza l'epoca globale se tutti i lettori attivi l'hanno già osservata.
+ * Restituisce l'epoca globale corrente.
  */
-int hash_insert(HashTable* ht, char* key, void* element) {
-        size_t hash;
-        int retr;
+static
+unsigned long epoch_try_advance(void) {
+        unsigned long epoch;
+        unsigned long local;
+        EpochRecord* r;
 
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
 
-        // Controllo che chiave ed elemento non siano nulli
-        if (key == NULL || element == NULL) {
-                return -1;
+        for (r = load_acquire(&epoch_records); r != NULL; r = r->next) {
+                local = __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST);
+                if ((local & EPOCH_ACTIVE) && (local & ~EPOCH_ACTIVE) != epoch) {
+                        return epoch;
+                }
         }
 
-        // Acquisisco il lock per la scrittura
-        wrlock(&ht->lock);
+        __atomic_compare_exchange_n(&global_epoch, &epoch, epoch + EPOCH_STEP,
+                                    0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        return load_acquire(&global_epoch);
+}
 
-        // Verifico che il numero di nodi all'interno della HashTable non
-        // superi il valore di densità superiore stabilito. In caso contrario
-        // procedo a espandere la HashTable raddoppiandone le dimensioni
-        if ((int) (ht->num_elements*100/ht->size) >= ht->high_density) {
-                LOG(("HashTable troppo PICCOLA, devo ridimensionare!\n"));
-                
-                if (hash_expand(ht)) {
-                        LOG(("HashTable espansa! Nuova dimensione: %ld\n", 
-                                ht->size));
-                }
-        }
+/*
+ * Tracciamento, compilato solo con HASH_TRACE: ogni thread accumula le
+ * proprie misure in un record, allineato alla linea di cache e aggiunto a
+ * una lista globale come quelli delle epoche, che hash_trace_snapshot
+ * somma. Ogni record viene scritto solo dal proprio thread, per cui basta
+ * pubblicarne i contatori con accessi atomici rilassati. Alla terminazione
+ * del thread il record resta nella lista con le sue misure e viene
+ * riutilizzato dal prossimo thread. Senza HASH_TRACE le macro TRACE_*
+ * non generano codice.
+ */
+#ifdef HASH_TRACE
+typedef struct trace_record {
+        _Alignas(HASH_CACHE_LINE) HashTrace trace;
+        uint64_t hold_start;
+        int in_use;
+        struct trace_record* next;
+} TraceRecord;
 
-        // Computo il digest della chiave data
-        hash = hash_value(ht, key);
-        LOG(("Key: %s --> Digest: %lu\n", key, hash));
-        
-        // Utilizzo la funzione d'inserimento e controllo il valore restituito
-        retr = insert(ht->node, hash, key, element, ht->size);
-        if (retr == 1) {
-                // Nel caso in cui sia uno, cioè di nuova chiave,
-                // incremento il numero di elementi della HashTable
-                ht->num_elements++;
-        }
+static TraceRecord* trace_records = NULL;
+static pthread_key_t trace_key;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static _Thread_local TraceRecord* trace_self = NULL;
 
-        // Rilascio il lock
-        rwlunlock(&ht->lock);
-        // Ritorno il valore restituito dall'inserimento
-        return retr;
+static
+void trace_release(void* record) {
+        store_release(&((TraceRecord*) record)->in_use, 0);
 }
 
-void* hash_get(HashTable* ht, char* key) {
-        Node* found;
-        size_t hash;
+static
+void trace_init(void) {
+        pthread_key_create(&trace_key, trace_release);
+}
 
-        // Acquisisco il lock
-        rdlock(&ht->lock);
+static
+TraceRecord* trace_record(void) {
+        TraceRecord* r;
+        int free_slot;
 
-        // Controllo che il numero di elementi sia > 1 
-        // così da evitare il blocco di codice seguente
-        if (ht->num_elements == 0) {
-                rwlunlock(&ht->lock);
-                return NULL;
+        if (trace_self != NULL) {
+                return trace_self;
         }
 
-        // Viene computato il digest della chiave fornita
-        hash = hash_value(ht, key);
-        LOG(("Sto cercando l'elemento di chiave %s\n", key)); 
-
-        // Cerco il nodo indicato
-        found = find_node(ht->node, hash, key, ht->size);
-
-        // Rilascio il lock
-        rwlunlock(&ht->lock);
+        pthread_once(&trace_once, trace_init);
 
-        // Il nodo risulta vuoto nel caso in cui la chiave sia NULL oppure
-        // il nodo stesso. In caso contrario viene il nodo è popolato e
-        // restituisco l'elemento
-        if (found == NULL) {
-                return NULL;
+        for (r = load_acquire(&trace_records); r != NULL; r = r->next) {
+                free_slot = 0;
+                if (load_relaxed(&r->in_use) == 0 &&
+                    __atomic_compare_exchange_n(&r->in_use, &free_slot, 1, 0,
+                                                __ATOMIC_ACQ_REL,
+                                                __ATOMIC_RELAXED)) {
+                        break;
+                }
         }
-        if (found->key == NULL) {
-                return NULL;
-        } else {
-                return found->element;
+
+        if (r == NULL) {
+                r = aligned_alloc(HASH_CACHE_LINE, sizeof(TraceRecord));
+                if (r == NULL) {
+                        perror("Errore durante l'allocazione del record");
+                        abort();
+                }
+                memset(r, 0, sizeof(TraceRecord));
+                r->in_use = 1;
+                r->next = load_relaxed(&trace_records);
+                while (!__atomic_compare_exchange_n(&trace_records, &r->next,
+                                                    r, 0,
+                                                    __ATOMIC_RELEASE,
+                                                    __ATOMIC_RELAXED)) {
+                }
         }
+
+        pthread_setspecific(trace_key, r);
+        trace_self = r;
+        return r;
 }
 
-void* hash_remove(HashTable* ht, char* key) {
-        Node* found;
-        size_t hash;
+static inline
+uint64_t trace_now(void) {
+        struct timespec ts;
 
-        // Acquisisco il lock
-        wrlock(&ht->lock);
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
 
-        // Se il numero di elementi è 0 non vi sono nodi da rimuovere
-        if (ht->num_elements < 1) {
-                rwlunlock(&ht->lock);
-                return NULL;
+/*
+ * Aggiunge un valore all'istogramma: il bucket i conta i valori con i bit
+ * significativi, cioè compresi tra 2^(i-1) e 2^i - 1.
+ */
+static inline
+void trace_add(HashTraceHistogram* h, uint64_t value) {
+        size_t i = value == 0 ? 0 : 64 - __builtin_clzl(value);
+
+        if (i >= HASH_TRACE_BUCKETS) {
+                i = HASH_TRACE_BUCKETS - 1;
+        }
+        store_relaxed(&h->count, h->count + 1);
+        store_relaxed(&h->sum, h->sum + value);
+        if (value > h->max) {
+                store_relaxed(&h->max, value);
         }
+        store_relaxed(&h->bucket[i], h->bucket[i] + 1);
+}
 
-        // Verifico che il numero di nodi all'interno della HashTable non
-        // sia al di sotto del valore di densità superiore stabilito.
-        // In caso contrario procedo a espandere la HashTable dimezzandone
-        // le dimensioni
-        if ((int) (ht->num_elements*100/ht->size) <= ht->low_density) {
-                LOG(("HashTable troppo GRANDE, devo ridimensionare!\n"));
+  #define TRACE_START(t) uint64_t t = trace_now()
+  #define TRACE_SINCE(field, t) \
+          trace_add(&trace_record()->trace.field, trace_now() - (t))
+  #define TRACE_VALUE(field, v) trace_add(&trace_record()->trace.field, (v))
+  #define TRACE_HOLD_BEGIN() (trace_record()->hold_start = trace_now())
+  #define TRACE_HOLD_END() TRACE_SINCE(lock_hold, trace_record()->hold_start)
+#else
+  #define TRACE_START(t) (void)0
+  #define TRACE_SINCE(field, t) (void)0
+  #define TRACE_VALUE(field, v) (void)0
+  #define TRACE_HOLD_BEGIN() (void)0
+  #define TRACE_HOLD_END() (void)0
+#endif
+
+/*
+ * Le misure di ogni thread vengono lette atomicamente e sommate: la
+ * fotografia è coerente per ogni contatore, non tra contatori diversi.
+ */
+int hash_trace_snapshot(HashTrace* out) {
+#ifdef HASH_TRACE
+        HashTraceHistogram* from;
+        HashTraceHistogram* to;
+        TraceRecord* r;
+        size_t h, i, max;
+        size_t n = sizeof(HashTrace) / sizeof(HashTraceHistogram);
 
-                if (hash_shrink(ht)) {
-                        LOG(("HashTable rimpicciolita! Nuova dimensione: "
-                             "%ld\n", ht->size));
+        memset(out, 0, sizeof(HashTrace));
+        for (r = load_acquire(&trace_records); r != NULL; r = r->next) {
+                from = (HashTraceHistogram*) &r->trace;
+                to = (HashTraceHistogram*) out;
+                for (h = 0; h < n; h++) {
+                        to[h].count += load_relaxed(&from[h].count);
+                        to[h].sum += load_relaxed(&from[h].sum);
+                        max = load_relaxed(&from[h].max);
+                        if (max > to[h].max) {
+                                to[h].max = max;
+                        }
+                        for (i = 0; i < HASH_TRACE_BUCKETS; i++) {
+                                to[h].bucket[i] +=
+                                        load_relaxed(&from[h].bucket[i]);
+                        }
                 }
         }
-        
-        // Computo l'hash della chiave data
-        hash = hash_value(ht, key);
-        LOG(("Inizio la rimozione dell'elemento con chiave: %lu\n", hash));
+        return 0;
+#else
+        memset(out, 0, sizeof(HashTrace));
+        return -1;
+#endif
+}
 
-        // Cerco il nodo indicato
-        found = find_node(ht->node, hash, key, ht->size);
+/*
+ * Libera gli elementi del limbo ritirati almeno due epoche fa. Gli elementi
+ * sono in ordine di epoca, quindi ne viene liberato un prefisso.
+ */
+static
+void reclaim(HashShard* shard) {
+        unsigned long epoch = epoch_try_advance();
+        size_t i;
 
-        // Il nodo risulta vuoto nel caso in cui la chiave oppure
-        // il nodo stesso sia NULL. In caso contrario il nodo è popolato e
-        // procedo a rimuoverlo e decrementare il numero di elementi
-        if (found == NULL) {
-                rwlunlock(&ht->lock);
-                return NULL;
-        }
-        if (found->key != NULL) {
-                // Decremento il numero di elementi
-                ht->num_elements--;
-                free(found->key);
-                free(found->element);
-                // Pongo la chiave NULL e l'elemento a TOMBSTONE
-                found->key = NULL;
-                found->element = TOMBSTONE;
-
-                // Rilascio il lock
-                rwlunlock(&ht->lock);
-                return found;
+        for (i = 0; i < shard->limbo_len; i++) {
+                if (shard->limbo[i].epoch + 2 * EPOCH_STEP > epoch) {
+                        break;
+                }
+                arena_free(shard, shard->limbo[i].ptr, shard->limbo[i].size);
         }
 
-        // Rilascio il lock
-        rwlunlock(&ht->lock);
-        return NULL;
+        memmove(shard->limbo,
+                shard->limbo + i,
+                (shard->limbo_len - i) * sizeof(HashRetired));
+        shard->limbo_len -= i;
 }
 
-size_t hash_num_elements(HashTable* ht) {
-        size_t busy_nodes = 0;
-        size_t i;
+/*
+ * Ritira la memoria non più raggiungibile dallo shard: verrà liberata
+ * quando nessun lettore potrà più riferirla. Va chiamata con il lock
+ * in scrittura dello shard.
+ */
+static
+void retire(HashShard* shard, void* ptr, size_t chunk) {
+        HashRetired* limbo;
+        size_t size;
 
-        // Controllo nodo per nodo se non sono nulli
-        // e in caso affermativo incremento il numero
-        // di nodi attualmente occupati
-        for (i = 0; i < ht->size; i++) {
-                if (ht->node[i].key != NULL) {
-                        busy_nodes++;
+        if (shard->limbo_len == shard->limbo_size) {
+                if (shard->limbo_len > 0) {
+                        reclaim(shard);
+                }
+
+                // Se il limbo è ancora mezzo pieno ne raddoppio la
+                // dimensione, così che i tentativi di liberare
+                // restino ammortizzati
+                if (shard->limbo_len > shard->limbo_size / 2 ||
+                    shard->limbo_size == 0) {
+                        size = shard->limbo_size * 2;
+                        if (size < LIMBO_RECLAIM) {
+                                size = LIMBO_RECLAIM;
+                        }
+                        limbo = realloc(shard->limbo,
+                                        size * sizeof(HashRetired));
+                        if (limbo == NULL) {
+                                // Senza memoria non posso sapere quando
+                                // liberare in sicurezza: rinuncio
+                                perror("Errore durante l'allocazione del "
+                                       "limbo");
+                                return;
+                        }
+                        shard->limbo = limbo;
+                        shard->limbo_size = size;
                 }
         }
-        return busy_nodes;
+
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        shard->limbo[shard->limbo_len].ptr = ptr;
+        shard->limbo[shard->limbo_len].size = chunk;
+        shard->limbo[shard->limbo_len].epoch =
+                __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+        shard->limbo_len++;
 }
 
-void hash_set_resize_high_density(struct hash_table* ht, int fill_factor) {
-        if (fill_factor < 1 || fill_factor > 99) {
-                return;
-        }
+/*
+ * Sequence lock dello shard: lo scrittore, che possiede già il lock in
+ * scrittura, rende dispari il contatore durante la modifica dei nodi;
+ * il lettore ripete la ricerca se il contatore è cambiato nel frattempo.
+ */
+static inline
+unsigned long read_begin(HashShard* shard) {
+        unsigned long seq;
 
-        if (fill_factor + fill_factor < fill_factor) {
-                return;
+        while ((seq = load_acquire(&shard->seq)) & 1) {
+                sched_yield();
         }
-
-        ht->high_density = fill_factor;
+        return seq;
 }
 
-void hash_set_resize_low_density(struct hash_table* ht, int fill_factor) {
-        if (fill_factor < 1 || fill_factor > 99) {
-                return;
-        }
+static inline
+Boolean read_retry(HashShard* shard, unsigned long seq) {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        return load_relaxed(&shard->seq) != seq;
+}
 
-        if (fill_factor + fill_factor < fill_factor) {
-                return;
-        }
+static inline
+void write_begin(HashShard* shard) {
+        store_relaxed(&shard->seq, shard->seq + 1);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+}
 
-        ht->low_density = fill_factor;
+static inline
+void write_end(HashShard* shard) {
+        store_release(&shard->seq, shard->seq + 1);
 }
 
-void destroy_hash_table(HashTable* ht) {
-        for (size_t i = 0; i < ht->size; i++) {
-                if (ht->node[i].key != NULL) {
-                        free(ht->node[i].key);
-                        free(ht->node[i].element);
-                }
+/*
+ * Lock in scrittura dello shard per inserimenti e rimozioni: non viene
+ * acquisito se la tabella appartiene a un solo thread.
+ */
+static inline
+void lock_shard(HashShard* shard) {
+        if (!shard->local) {
+                TRACE_START(wait);
+                wrlock(&shard->lock);
+                TRACE_SINCE(lock_wait, wait);
+                TRACE_HOLD_BEGIN();
         }
+}
 
-        free(ht->node);
-        free(ht);
+static inline
+void unlock_shard(HashShard* shard) {
+        if (!shard->local) {
+                TRACE_HOLD_END();
+                rwlunlock(&shard->lock);
+        }
 }
 
 /*
- * Stampa a schermo il contenuto della HashTable formattato
+ * Indirizzamento: la cella di partenza viene ricavata senza divisioni dai
+ * soli DIGEST_BITS del digest, quelli salvati nel nodo, mascherandone i
+ * bit bassi se la dimensione è una potenza di due, altrimenti con la
+ * riduzione di Lemire (i bit alti del prodotto digest * size). Anche
+ * l'avanzamento del probing evita il modulo.
  */
-void pretty_print(HashTable* ht) {
+#define DIGEST_BITS 0xFFFFFFFF00000000UL
+
+static inline
+size_t bucket(NodeArray* table, size_t digest) {
+        digest &= DIGEST_BITS;
+        if (table->mask != 0) {
+                return (digest >> 32) & table->mask;
+        }
+        return (size_t) (((uint128) digest * table->size) >> 64);
+}
+
+static inline
+size_t next_cell(NodeArray* table, size_t hash) {
+        return ++hash == table->size ? 0 : hash;
+}
+
+/*
+ * Chiavi dei nodi: quelle corte sono copiate nel nodo dopo un byte che
+ * vale il doppio della lunghezza più 1, le altre sono puntatori spostati a
+ * sinistra di un bit seguiti dalla lunghezza. La forma è quindi decisa
+ * dalla sola prima parola, letta atomicamente, così che un lettore senza
+ * lock non segua mai come puntatore i byte di una chiave corta scritta nel
+ * frattempo. Le chiavi possono contenere byte nulli: vengono confrontate
+ * per lunghezza e poi con memcmp. La chiave cercata viene preparata una
+ * volta sola nella forma che avrebbe nel nodo.
+ * La metà alta della seconda parola contiene i 32 bit alti del digest, per
+ * cui il nodo resta di tre parole: il digest viene confrontato insieme
+ * alla chiave, e cella di partenza e frammento del motore swiss vengono
+ * ricavati solo da quei bit, così che un ridimensionamento non debba
+ * ricalcolarli.
+ * Il primo byte di una chiave corta deve coincidere con il bit basso della
+ * prima parola, che in un puntatore spostato vale sempre 0: questo vale
+ * solo sulle architetture little-endian. Su quelle big-endian il primo
+ * byte è quello alto della parola, che un puntatore spostato può avere
+ * diverso da 0, per cui la compilazione viene interrotta.
+ */
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+  #error "hash.c richiede un'architettura little-endian"
+#endif
+
+#define INLINE_TAG 1UL
+
+typedef struct search_key {
+        const char* str;
+        size_t len;
+        NodeKey node;
+} SearchKey;
+
+/*
+ * Prepara la chiave cercata nella forma che avrebbe nel nodo, ma senza i
+ * bit del digest: vengono aggiunti da search_word, così che la chiave
+ * possa essere scritta prima di calcolare il digest. Scriverla dopo
+ * lascerebbe le scritture in sospeso fino alla barriera di
+ * hash_epoch_enter, che le attende. Una chiave più lunga di HASH_MAX_KEY
+ * ha lunghezza 0, che nessuna chiave lunga di un nodo può avere.
+ */
+static inline
+void make_search_key(SearchKey* k, const char* key, size_t len) {
+        k->str = key;
+        k->len = len;
+        k->node.word[0] = 0;
+        k->node.word[1] = 0;
+        if (len <= HASH_INLINE_KEY) {
+                k->node.bytes[0] = (char) (len << 1 | 1);
+                memcpy(k->node.bytes + 1, key, len);
+        } else if (len <= HASH_MAX_KEY) {
+                k->node.word[1] = len;
+        }
+}
+
+/*
+ * Restituisce la seconda parola che la chiave cercata ha nel nodo, con i
+ * bit del digest.
+ */
+static inline
+size_t search_word(SearchKey* k, size_t digest) {
+        return k->node.word[1] | (digest & DIGEST_BITS);
+}
+
+/*
+ * Forma nel nodo di una chiave lunga copiata in key, di cui second è la
+ * seconda parola restituita da search_word.
+ */
+static inline
+NodeKey pointer_key(const char* key, size_t second) {
+        NodeKey node_key = {{(size_t) key << 1, second}};
+
+        return node_key;
+}
+
+/*
+ * Restituisce il puntatore di una chiave lunga, NULL se la chiave è corta.
+ */
+static inline
+char* key_pointer(NodeKey* key) {
+        return (key->word[0] & INLINE_TAG) ? NULL : (char*) (key->word[0] >> 1);
+}
+
+static inline
+char* key_string(NodeKey* key) {
+        return (key->word[0] & INLINE_TAG) ? key->bytes + 1 : key_pointer(key);
+}
+
+static inline
+size_t key_length(NodeKey* key) {
+        return (key->word[0] & INLINE_TAG) ?
+               (unsigned char) key->bytes[0] >> 1 :
+               key->word[1] & ~DIGEST_BITS;
+}
+
+/*
+ * Restituisce i bit del digest salvati nel nodo, nella posizione che
+ * hanno nel digest: gli altri valgono 0.
+ */
+static inline
+size_t node_digest(Node* node) {
+        return load_relaxed(&node->key.word[1]) & DIGEST_BITS;
+}
+
+/*
+ * Confronta la chiave cercata con quella di un nodo occupato, di cui word
+ * è la prima parola già letta e second la seconda parola della chiave
+ * cercata (search_word): una chiave corta si trova solo nel nodo. La
+ * seconda parola contiene il digest e, per una chiave lunga, la
+ * lunghezza: se coincide viene riletta la prima parola, e se non è
+ * cambiata la lunghezza appartiene a quel puntatore, per cui memcmp non
+ * legge oltre la fine della chiave.
+ */
+static inline
+Boolean key_equal(Node* node, size_t word, size_t second, SearchKey* k) {
+        if (k->len <= HASH_INLINE_KEY) {
+                return word == k->node.word[0] &&
+                       load_relaxed(&node->key.word[1]) == second;
+        }
+        return (word & INLINE_TAG) == 0 &&
+               load_acquire(&node->key.word[1]) == second &&
+               load_relaxed(&node->key.word[0]) == word &&
+               memcmp(k->str, (char*) (word >> 1), k->len) == 0;
+}
+
+/*
+ * Pubblica la chiave di un nodo scrivendo per ultima la prima parola.
+ * La prima parola viene prima azzerata, così che un lettore che vede la
+ * nuova seconda parola non veda più il puntatore precedente.
+ */
+static inline
+void store_key(Node* node, NodeKey key) {
+        store_relaxed(&node->key.word[0], 0);
+        store_release(&node->key.word[1], key.word[1]);
+        store_release(&node->key.word[0], key.word[0]);
+}
+
+static inline
+void erase_key(Node* node) {
+        store_relaxed(&node->key.word[0], 0);
+        store_relaxed(&node->key.word[1], 0);
+}
+
+/*
+ * Motore swiss: ad ogni nodo corrisponde un byte di controllo che vale
+ * CTRL_EMPTY, CTRL_DELETED oppure 7 bit del digest della chiave. La ricerca
+ * confronta un gruppo di GROUP_WIDTH byte alla volta (32 con AVX2, 16 con
+ * SSE2, 8 con il codice scalare) e legge i nodi solo per i byte che
+ * corrispondono al frammento cercato. Le letture vettoriali dei gruppi non
+ * sono atomiche: un lettore senza lock può vedere byte in modifica, ma in
+ * quel caso il sequence lock gli fa ripetere la ricerca.
+ */
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xFE
+#define SWISS_MAX_LOAD 87
+
+#if defined(__AVX2__)
+#define GROUP_WIDTH 32
+
+static inline
+uint32_t group_match(const unsigned char* ctrl, unsigned char c) {
+        __m256i group = _mm256_loadu_si256((const __m256i*) ctrl);
+
+        return (uint32_t) _mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(group, _mm256_set1_epi8((char) c)));
+}
+
+// Il bit più significativo è acceso sia per CTRL_EMPTY che per CTRL_DELETED
+static inline
+uint32_t group_free(const unsigned char* ctrl) {
+        return (uint32_t) _mm256_movemask_epi8(
+                _mm256_loadu_si256((const __m256i*) ctrl));
+}
+#elif defined(__SSE2__)
+#define GROUP_WIDTH 16
+
+static inline
+uint32_t group_match(const unsigned char* ctrl, unsigned char c) {
+        __m128i group = _mm_loadu_si128((const __m128i*) ctrl);
+
+        return (uint32_t) _mm_movemask_epi8(
+                _mm_cmpeq_epi8(group, _mm_set1_epi8((char) c)));
+}
+
+// Il bit più significativo è acceso sia per CTRL_EMPTY che per CTRL_DELETED
+static inline
+uint32_t group_free(const unsigned char* ctrl) {
+        return (uint32_t) _mm_movemask_epi8(
+                _mm_loadu_si128((const __m128i*) ctrl));
+}
+#else
+#define GROUP_WIDTH 8
+
+static inline
+uint32_t group_match(const unsigned char* ctrl, unsigned char c) {
+        uint32_t mask = 0;
+        int i;
+
+        for (i = 0; i < GROUP_WIDTH; i++) {
+                mask |= (uint32_t) (load_relaxed(&ctrl[i]) == c) << i;
+        }
+        return mask;
+}
+
+static inline
+uint32_t group_free(const unsigned char* ctrl) {
+        uint32_t mask = 0;
+        int i;
+
+        for (i = 0; i < GROUP_WIDTH; i++) {
+                mask |= (uint32_t) (load_relaxed(&ctrl[i]) >> 7) << i;
+        }
+        return mask;
+}
+#endif
+
+/*
+ * Frammento di 7 bit del digest salvato nel byte di controllo: combina
+ * bit alti e bassi dei DIGEST_BITS, così da restare utile anche con
+ * funzioni di hash che non mescolano bene i bit alti.
+ */
+static inline
+unsigned char ctrl_hash(size_t digest) {
+        return (unsigned char) (((digest >> 57) ^ (digest >> 32)) & 0x7f);
+}
+
+/*
+ * Aggiorna il byte di controllo del nodo e le sue copie in coda all'array.
+ * Non fa nulla con il motore lineare.
+ */
+static inline
+void set_ctrl(NodeArray* table, Node* node, unsigned char c) {
+        size_t i;
+
+        if (table->ctrl == NULL) {
+                return;
+        }
+
+        for (i = node - table->node;
+             i < table->size + GROUP_WIDTH - 1;
+             i += table->size) {
+                store_relaxed(&table->ctrl[i], c);
+        }
+}
+
+/*
+ * Indice del nodo corrispondente al bit meno significativo di mask in un
+ * gruppo che inizia in pos, senza divisioni.
+ */
+static inline
+size_t group_index(NodeArray* table, size_t pos, uint32_t mask) {
+        size_t index = pos + __builtin_ctz(mask);
+
+        while (index >= table->size) {
+                index -= table->size;
+        }
+        return index;
+}
+
+/*
+ * Equivalente di find_node per il motore swiss: scandisce i nodi nello
+ * stesso ordine, ma un gruppo alla volta. Restituisce il nodo con la
+ * chiave cercata oppure il primo nodo libero incontrato.
+ */
+static
+Node* find_node_swiss(NodeArray* table, size_t digest, SearchKey* k) {
+        size_t pos = bucket(table, digest);
+        unsigned char fragment = ctrl_hash(digest);
+        size_t second = search_word(k, digest);
+        Node* found = NULL;
+        Node* node;
+        size_t word;
+        uint32_t match, empty, before, free_mask;
+        size_t counter;
+
+        for (counter = 0; counter < table->size; counter += GROUP_WIDTH) {
+                match = group_match(table->ctrl + pos, fragment);
+                empty = group_match(table->ctrl + pos, CTRL_EMPTY);
+
+                // Considero solo i nodi che precedono il primo EMPTY,
+                // dove la ricerca lineare si fermerebbe
+                before = empty != 0 ? (empty & -empty) - 1 : ~(uint32_t) 0;
+
+                for (match &= before; match != 0; match &= match - 1) {
+                        node = &table->node[group_index(table, pos, match)];
+                        word = load_acquire(&node->key.word[0]);
+                        if (word != 0 &&
+                            key_equal(node, word, second, k)) {
+                                TRACE_VALUE(probes, counter / GROUP_WIDTH);
+                                return node;
+                        }
+                }
+
+                // Ricordo il primo nodo libero per hash_insert
+                if (found == NULL) {
+                        free_mask = group_free(table->ctrl + pos) &
+                                    (before | (empty & -empty));
+                        if (free_mask != 0) {
+                                found = &table->node[group_index(table,
+                                                                 pos,
+                                                                 free_mask)];
+                        }
+                }
+
+                if (empty != 0) {
+                        TRACE_VALUE(probes, counter / GROUP_WIDTH);
+                        return found;
+                }
+                pos = group_index(table, pos + GROUP_WIDTH, 1);
+        }
+
+        TRACE_VALUE(probes, counter / GROUP_WIDTH);
+        return found;
+}
+
+/*
+ * Rimescola i bit del digest (finalizzatore di MurmurHash3), così che tutti
+ * i bit dipendano da tutta la chiave anche con funzioni di hash deboli come
+ * sdbm e djb2 su chiavi corte.
+ */
+static inline
+size_t hash_mix(size_t hash) {
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdUL;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53UL;
+        hash ^= hash >> 33;
+        return hash;
+}
+
+/*
+ * Digest di una chiave come usato dalla tabella: la funzione di hash della
+ * tabella, con il suo seme, seguita dal rimescolamento, così che maschera,
+ * riduzione di Lemire e frammenti del motore swiss ricevano bit ben
+ * distribuiti anche da una funzione personalizzata debole.
+ */
+static inline
+size_t key_digest(HashTable* ht, SearchKey* k) {
+        return hash_mix(ht->hash_function(k->str, k->len, ht->seed));
+}
+
+/*
+ * Restituisce lo shard a cui appartiene il digest, scelto in base ai bit
+ * più significativi dello stesso dopo un ulteriore rimescolamento: quelli
+ * del digest scelgono già la cella con la riduzione di Lemire.
+ */
+static inline
+HashShard* get_shard(HashTable* ht, size_t hash) {
+        if (ht->shard_bits == 0) {
+                return &ht->shard[0];
+        }
+        return &ht->shard[hash_mix(hash) >> (64 - ht->shard_bits)];
+}
+
+/*
+ * Alloca un array di size nodi, tutti EMPTY. Dato che EMPTY vale 0 basta
+ * la calloc: le pagine non vengono toccate finché non servono, per cui
+ * l'allocazione non costa un passaggio su tutto l'array.
+ */
+static
+NodeArray* new_node_array(size_t size, Boolean swiss, Boolean robin_hood) {
+        NodeArray* table;
+        size_t ctrl_size = swiss ? size + GROUP_WIDTH - 1 : 0;
+
+        table = calloc(1, sizeof(NodeArray) + size * sizeof(Node) + ctrl_size);
+        if (table == NULL) {
+                return NULL;
+        }
+        table->size = size;
+        table->mask = (size & (size - 1)) == 0 ? size - 1 : 0;
+        table->robin_hood = robin_hood;
+
+        // Con il motore swiss i byte di controllo seguono i nodi
+        table->ctrl = NULL;
+        if (swiss) {
+                table->ctrl = (unsigned char*) (table->node + size);
+                memset(table->ctrl, CTRL_EMPTY, ctrl_size);
+        }
+
+        return table;
+}
+
+/*
+ * Seme casuale della tabella, così che chi sceglie le chiavi non possa
+ * prevederne le collisioni. Se il kernel non fornisce byte casuali il seme
+ * viene ricavato dall'orologio e dall'indirizzo della tabella.
+ */
+static
+size_t random_seed(HashTable* ht) {
+        struct timespec ts;
+        size_t seed;
+
+        if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) ==
+            (ssize_t) sizeof(seed)) {
+                return seed;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return hash_mix((size_t) ts.tv_nsec ^ ((size_t) ts.tv_sec << 32) ^
+                        (size_t) (uintptr_t) ht);
+}
+
+HashTable* create_hash_table(size_t size, size_t num_shards) {
+        HashTable* ht;
+        HashShard* shard;
+        size_t shard_size;
+        size_t i;
+
+        // Controllo che la dimensione non sia troppo grande
+        // e quindi faccia overflow
+        if (size + size < size) {
+                perror("Dimensione troppo grande");
+                return NULL;
+        }
+
+        if (size == 0) {
+                perror("Dimensione troppo piccola");
+                return NULL;
+        }
+
+        // Arrotondo il numero di shard alla potenza di due successiva,
+        // così da sceglierli con i bit alti dell'hash
+        ht = malloc(sizeof(HashTable));
+        if (ht == NULL) {
+                perror("Errore durante l'allocazione della HashTable");
+                return NULL;
+        }
+        ht->shard_bits = 0;
+        while (((size_t) 1 << ht->shard_bits) < num_shards &&
+               ht->shard_bits < 16) {
+                ht->shard_bits++;
+        }
+        ht->num_shards = (size_t) 1 << ht->shard_bits;
+        ht->hash_function = DEFAULT_HASH_FUNCTION;
+        ht->ownership = HASH_OWN_STRING;
+        ht->element_size = 0;
+        ht->seed = random_seed(ht);
+        ht->image = NULL;
+        ht->density_set = false;
+
+        // Ogni shard riceve una porzione uguale delle celle richieste
+        shard_size = (size + ht->num_shards - 1) / ht->num_shards;
+
+        // Alloco gli shard allineati alla linea di cache
+        ht->shard = aligned_alloc(HASH_CACHE_LINE,
+                                  ht->num_shards * sizeof(HashShard));
+        if (ht->shard == NULL) {
+                free(ht);
+                perror("Errore durante l'allocazione degli shard");
+                return NULL;
+        }
+
+        for (i = 0; i < ht->num_shards; i++) {
+                shard = &ht->shard[i];
+
+                // Alloco lo spazio per i singoli nodi
+                shard->table = new_node_array(shard_size, false, false);
+                if (shard->table == NULL) {
+                        while (i-- > 0) {
+                                pthread_rwlock_destroy(&ht->shard[i].lock);
+                                free(ht->shard[i].table);
+                        }
+                        free(ht->shard);
+                        free(ht);
+                        perror("Errore durante l'allocazione dei nodi");
+                        return NULL;
+                }
+
+                // Inizializzo il lock
+                pthread_rwlock_init(&shard->lock, NULL);
+
+                // Inizializzo gli altri membri della struct
+                shard->old = NULL;
+                shard->migrated = 0;
+                shard->incremental = false;
+                shard->resize_threads = 1;
+                shard->local = false;
+                shard->num_elements = 0;
+                shard->tombstone_density = TABLE_MAX_TOMBSTONES;
+                shard->expansions = 0;
+                shard->shrinks = 0;
+                shard->compactions = 0;
+                shard->seq = 0;
+                shard->high_density = TABLE_MAX_LOAD;
+                shard->low_density = TABLE_MIN_LOAD;
+                shard->limbo = NULL;
+                shard->limbo_len = 0;
+                shard->limbo_size = 0;
+                shard->arena = NULL;
+        }
+
+        return ht;
+}
+
+/*
+ * Politica Robin Hood: la distanza di un nodo dalla propria cella di
+ * partenza viene ricavata dal digest salvato. Durante l'inserimento una
+ * chiave prende il posto di quelle più vicine alla propria cella, per cui
+ * la ricerca può fermarsi appena incontra un nodo meno distante di quanto
+ * lo sarebbe la chiave cercata. Negli array che vengono svuotati da un
+ * ridimensionamento incrementale possono comparire delle TOMBSTONE, che
+ * la ricerca salta.
+ */
+static inline
+size_t displacement(NodeArray* table, size_t pos, size_t digest) {
+        size_t home = bucket(table, digest);
+
+        return pos >= home ? pos - home : pos + table->size - home;
+}
+
+static
+Node* find_node_robin_hood(NodeArray* table, size_t digest, SearchKey* k) {
+        Node* node = table->node;
+        size_t hash = bucket(table, digest);
+        size_t second = search_word(k, digest);
+        size_t distance;
+        size_t node_hash;
+        size_t word;
+
+        for (distance = 0; distance < table->size; distance++) {
+                word = load_acquire(&node[hash].key.word[0]);
+                if (word == 0) {
+                        if (load_relaxed(&node[hash].element) == EMPTY) {
+                                TRACE_VALUE(probes, distance);
+                                return NULL;
+                        }
+                } else {
+                        if (key_equal(&node[hash], word, second, k)) {
+                                TRACE_VALUE(probes, distance);
+                                return &node[hash];
+                        }
+                        node_hash = node_digest(&node[hash]);
+                        if (displacement(table, hash, node_hash) < distance) {
+                                TRACE_VALUE(probes, distance);
+                                return NULL;
+                        }
+                }
+
+                hash = next_cell(table, hash);
+        }
+
+        TRACE_VALUE(probes, distance);
+        return NULL;
+}
+
+/*
+ * Copia il nodo src in dst. Va chiamata dentro il sequence lock.
+ */
+static inline
+void move_node(Node* dst, Node* src) {
+        store_release(&dst->element, src->element);
+        store_key(dst, src->key);
+}
+
+/*
+ * Inserisce una chiave non presente scambiandola con i nodi più vicini
+ * alla propria cella di partenza. L'array deve avere almeno un nodo EMPTY.
+ * Va chiamata dentro il sequence lock se l'array è visibile ai lettori.
+ */
+static
+void robin_hood_insert(NodeArray* table, size_t digest, NodeKey key,
+                       void* element) {
+        Node carry = { key, element };
+        Node swap;
+        size_t hash = bucket(table, digest);
+        size_t distance = 0;
+        size_t node_distance;
+
+        while (table->node[hash].key.word[0] != 0) {
+                node_distance = displacement(table, hash,
+                                             node_digest(&table->node[hash]));
+                if (node_distance < distance) {
+                        swap = table->node[hash];
+                        move_node(&table->node[hash], &carry);
+                        carry = swap;
+                        distance = node_distance;
+                }
+
+                hash = next_cell(table, hash);
+                distance++;
+        }
+
+        move_node(&table->node[hash], &carry);
+}
+
+/*
+ * Rimuove un nodo riportando indietro di una posizione i nodi che lo
+ * seguono, finché non si incontra un nodo vuoto o già nella propria cella:
+ * l'array non contiene mai TOMBSTONE. Va chiamata dentro il sequence lock.
+ */
+static
+void robin_hood_remove(NodeArray* table, Node* found) {
+        size_t hash = found - table->node;
+        size_t next = next_cell(table, hash);
+
+        while (table->node[next].key.word[0] != 0 &&
+               displacement(table, next,
+                            node_digest(&table->node[next])) > 0) {
+                move_node(&table->node[hash], &table->node[next]);
+                hash = next;
+                next = next_cell(table, next);
+        }
+
+        erase_key(&table->node[hash]);
+        store_relaxed(&table->node[hash].element, EMPTY);
+}
+
+/*
+ * Questa funzione è il cuore dell'intera HashTable: utilizza il meccanismo
+ * di LINEAR PROBING per trovare un nodo non NULL, spostandosi a destra di
+ * una posizione ogni volta che ne incontra uno. Una chiave lunga viene
+ * letta solo se i bit del digest salvati nel nodo coincidono con quelli
+ * cercati, così da non leggere la memoria delle chiavi degli altri nodi.
+ * Viene usata anche dai lettori senza lock, per cui legge i nodi con
+ * accessi atomici: le chiavi sono pubblicate con semantica release e
+ * restano valide grazie alle epoche.
+ */
+static
+Node* find_node(NodeArray* table, size_t digest, SearchKey* k) {
+        Node* node = table->node;
+        size_t ht_size = table->size;
+        size_t hash = bucket(table, digest);
+        size_t second = search_word(k, digest);
+        Node* found = NULL;
+        size_t counter = 0;
+        size_t word;
+
+        if (table->ctrl != NULL) {
+                return find_node_swiss(table, digest, k);
+        }
+        if (table->robin_hood) {
+                return find_node_robin_hood(table, digest, k);
+        }
+
+        for (; counter < ht_size; counter++, hash = next_cell(table, hash)) {
+                word = load_acquire(&node[hash].key.word[0]);
+
+                // Controllo che il nodo non sia NULL
+                if (word == 0) {
+                        if (load_relaxed(&node[hash].element) == EMPTY) {
+                                // Se l'elemento è EMPTY allora è libero
+                                // per l'assegnazione
+                                TRACE_VALUE(probes, counter);
+                                return found != NULL ? found : &node[hash];
+                        }
+                        // Altrimenti il nodo è una TOMBSTONE, cioè un nodo
+                        // rimosso in precedenza
+                        if (found == NULL) {
+                                // Lo salviamo per il caso in cui questa
+                                // funzione venga usata da hash_insert,
+                                // cioè per la ricerca di un nodo NULL
+                                found = &node[hash];
+                        }
+                        continue;
+                }
+
+                // Qualora non sia vuoto confronto la chiave presente,
+                // insieme ai bit del digest, con quella fornita
+                if (key_equal(&node[hash], word, second, k)) {
+                        LOG(("Trovato alla pos. %lu\n", hash));
+                        TRACE_VALUE(probes, counter);
+                        return &node[hash];
+                }
+        }
+
+        // Nel caso in cui il ciclo sopra termini significa che non è
+        // presente l'elemento all'interno della HashTable, ma può esserci
+        // una TOMBSTONE libera
+        TRACE_VALUE(probes, counter);
+        return found;
+}
+
+/*
+ * Cerca la chiave nell'array corrente dello shard e, durante un
+ * ridimensionamento incrementale, in quello vecchio. Restituisce il nodo
+ * che la contiene oppure NULL.
+ */
+static
+Node* lookup(NodeArray* table, NodeArray* old, size_t digest, SearchKey* k) {
+        Node* found;
+
+        found = find_node(table, digest, k);
+        if (found != NULL && load_acquire(&found->key.word[0]) != 0) {
+                return found;
+        }
+
+        if (old != NULL) {
+                found = find_node(old, digest, k);
+                if (found != NULL && load_acquire(&found->key.word[0]) != 0) {
+                        return found;
+                }
+        }
+
+        return NULL;
+}
+
+/*
+ * Pubblica un nuovo array per lo shard e restituisce quello precedente,
+ * che va ritirato solo dopo la pubblicazione.
+ */
+static inline
+NodeArray* exchange_table(HashShard* shard, NodeArray* table) {
+        NodeArray* previous = shard->table;
+
+        write_begin(shard);
+        store_release(&shard->table, table);
+        write_end(shard);
+        return previous;
+}
+
+/*
+ * Restituisce l'array dello shard a cui appartiene il nodo.
+ */
+static inline
+NodeArray* owner(HashShard* shard, Node* node) {
+        NodeArray* table = shard->table;
+
+        if (node >= table->node && node < table->node + table->size) {
+                return table;
+        }
+        return shard->old;
+}
+
+/*
+ * Scrive chiave, con i bit del digest, ed elemento in un nodo libero,
+ * aggiornandone il byte di controllo. Se l'array è già visibile ai
+ * lettori va chiamata dentro il sequence lock.
+ */
+static inline
+void fill_node(NodeArray* table, Node* node,
+               size_t digest, NodeKey key, void* element) {
+        if (node->element == TOMBSTONE) {
+                table->tombstones--;
+        }
+        store_release(&node->element, element);
+        store_key(node, key);
+        set_ctrl(table, node, ctrl_hash(digest));
+}
+
+/*
+ * Trasforma un nodo popolato in una TOMBSTONE. Va chiamata dentro il
+ * sequence lock.
+ */
+static inline
+void clear_node(NodeArray* table, Node* node) {
+        erase_key(node);
+        store_relaxed(&node->element, TOMBSTONE);
+        set_ctrl(table, node, CTRL_DELETED);
+        table->tombstones++;
+}
+
+/*
+ * Dimensione nell'arena di un elemento stringa, oppure 0 se il blocco è
+ * stato allocato con malloc. La lunghezza viene calcolata solo se l'arena
+ * è abilitata.
+ */
+static inline
+size_t string_chunk(HashShard* shard, const char* str) {
+        if (shard->arena == NULL || !shard->arena->enabled) {
+                return 0;
+        }
+        return arena_size(shard, strlen(str) + 1);
+}
+
+/*
+ * Copia i len byte di str aggiungendo il terminatore.
+ */
+static inline
+char* copy_string(HashShard* shard, const char* str, size_t len) {
+        char* copy;
+
+        copy = arena_alloc(shard, len + 1);
+        if (copy != NULL) {
+                memcpy(copy, str, len);
+                copy[len] = '\0';
+        }
+        return copy;
+}
+
+/*
+ * Copia chiave ed elemento secondo la modalità di possesso della tabella:
+ * con le stringhe due copie (la chiave solo se with_key), in modalità
+ * binaria un solo blocco con i byte dell'elemento seguiti dalla chiave,
+ * in prestito nessuna copia. Le chiavi corte vengono sempre copiate nel
+ * nodo, per cui non richiedono allocazioni. Le copie vengono dall'arena
+ * dello shard se abilitata. Restituisce -1 se l'allocazione fallisce o se
+ * la chiave è più lunga di HASH_MAX_KEY.
+ */
+static
+int copy_entry(HashTable* ht, HashShard* shard, size_t digest, SearchKey* k,
+               void* element, Boolean with_key, NodeKey* key_copy,
+               void** element_copy) {
+        size_t second = search_word(k, digest);
+        char* block;
+
+        if (k->len > HASH_MAX_KEY) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        key_copy->word[0] = k->node.word[0];
+        key_copy->word[1] = second;
+        switch (ht->ownership) {
+        case HASH_OWN_BORROWED:
+                if (k->len > HASH_INLINE_KEY) {
+                        *key_copy = pointer_key(k->str, second);
+                }
+                *element_copy = element;
+                return 0;
+
+        case HASH_OWN_BINARY:
+                block = arena_alloc(shard, ht->element_size + k->len + 1);
+                if (block == NULL) {
+                        return -1;
+                }
+                memcpy(block, element, ht->element_size);
+                memcpy(block + ht->element_size, k->str, k->len);
+                block[ht->element_size + k->len] = '\0';
+                if (k->len > HASH_INLINE_KEY) {
+                        *key_copy = pointer_key(block + ht->element_size,
+                                                second);
+                }
+                *element_copy = block;
+                return 0;
+        }
+
+        *element_copy = copy_string(shard, element, strlen(element));
+        if (*element_copy == NULL) {
+                return -1;
+        }
+        if (with_key && k->len > HASH_INLINE_KEY) {
+                block = copy_string(shard, k->str, k->len);
+                *key_copy = pointer_key(block, second);
+                if (block == NULL) {
+                        arena_free(shard, *element_copy,
+                                   string_chunk(shard, *element_copy));
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+/*
+ * Ritira chiave ed elemento tolti da un nodo, secondo la modalità di
+ * possesso: key è NULL se la chiave resta nel nodo o vi è copiata perché
+ * corta, key_len è la sua lunghezza. In modalità binaria la chiave fa
+ * parte del blocco dell'elemento.
+ */
+static inline
+void release_entry(HashTable* ht, HashShard* shard,
+                   char* key, size_t key_len, void* element) {
+        switch (ht->ownership) {
+        case HASH_OWN_BORROWED:
+                return;
+
+        case HASH_OWN_BINARY:
+                retire(shard, element,
+                       arena_size(shard, ht->element_size + key_len + 1));
+                return;
+        }
+
+        if (key != NULL) {
+                retire(shard, key, arena_size(shard, key_len + 1));
+        }
+        retire(shard, element, string_chunk(shard, element));
+}
+
+/*
+ * Confronta due elementi secondo la modalità di possesso: come stringhe,
+ * come blocchi di element_size byte oppure come puntatori.
+ */
+static inline
+Boolean same_element(HashTable* ht, void* a, void* b) {
+        switch (ht->ownership) {
+        case HASH_OWN_BORROWED:
+                return a == b;
+        case HASH_OWN_BINARY:
+                return memcmp(a, b, ht->element_size) == 0;
+        }
+        return strcmp(a, b) == 0;
+}
+
+/*
+ * Cerca la chiave nello shard, anche nell'array vecchio, e passa alla
+ * funzione fn l'elemento trovato (o NULL se la chiave manca): l'elemento
+ * che restituisce viene copiato e inserito, o sostituisce quello presente.
+ * Se fn restituisce NULL o l'elemento stesso il nodo resta invariato.
+ * Le modifiche ai nodi avvengono dentro il sequence lock; l'elemento
+ * sovrascritto viene ritirato e non liberato subito. In result viene
+ * salvato l'elemento presente nel nodo al termine.
+ */
+static
+int insert(HashTable* ht, HashShard* shard, size_t digest, SearchKey* k,
+           HashUpdate fn, void* ctx, void** result) {
+        NodeArray* table = shard->table;
+        Node* found;
+        void* old;
+        void* element;
+        NodeKey key_copy;
+        void* element_copy;
+
+        found = find_node(table, digest, k);
+        if ((found == NULL || found->key.word[0] == 0) && shard->old != NULL) {
+                // La chiave può trovarsi ancora nell'array vecchio
+                old = lookup(shard->old, NULL, digest, k);
+                if (old != NULL) {
+                        found = old;
+                }
+        }
+        if (found == NULL) {
+                // Con la politica Robin Hood la ricerca non restituisce un
+                // nodo libero: basta che l'array non sia pieno
+                if (!table->robin_hood || shard->num_elements >= table->size) {
+                        return -1;
+                }
+        }
+
+        old = (found != NULL && found->key.word[0] != 0) ?
+              found->element : NULL;
+        *result = old;
+        element = fn((char*) k->str, old, ctx);
+        if (element == NULL || element == old) {
+                return 0;
+        }
+
+        // Effettuo una copia dell'elemento, e della chiave se nuova,
+        // secondo la modalità di possesso della tabella
+        TRACE_START(copy_start);
+        if (copy_entry(ht, shard, digest, k, element, old == NULL,
+                       &key_copy, &element_copy) != 0) {
+                return -1;
+        }
+        TRACE_SINCE(alloc, copy_start);
+        *result = element_copy;
+
+        if (old != NULL) {
+                // Se il nodo è popolato si tratta di un tentativo
+                // di sovrascrittura. In modalità binaria la chiave è
+                // nello stesso blocco dell'elemento e va sostituita
+                LOG(("Updating '%.*s' with %p element\n",
+                     (int) k->len, k->str, element));
+                write_begin(shard);
+                store_release(&found->element, element_copy);
+                if (ht->ownership == HASH_OWN_BINARY) {
+                        store_key(found, key_copy);
+                }
+                write_end(shard);
+                release_entry(ht, shard, NULL, k->len, old);
+                return 0;
+        }
+
+        // Se la chiave è NULL il nodo è EMPTY o TOMBSTONE
+        // e inscrivo i valori
+        LOG(("Inserting %p with '%.*s' key\n",
+             element, (int) k->len, k->str));
+        write_begin(shard);
+        if (found == NULL) {
+                robin_hood_insert(table, digest, key_copy, element_copy);
+        } else {
+                fill_node(table, found, digest, key_copy, element_copy);
+        }
+        write_end(shard);
+        return 1;
+}
+
+/*
+ * Colloca il nodo, senza copiarne chiave ed elemento né ricalcolarne il
+ * digest, nel primo nodo libero dell'array. Se l'array è già visibile ai
+ * lettori va chiamata dentro il sequence lock.
+ */
+static
+void place(NodeArray* table, Node* src) {
+        size_t digest = node_digest(src);
+        size_t hash = bucket(table, digest);
+
+        if (table->robin_hood) {
+                robin_hood_insert(table, digest, src->key, src->element);
+                return;
+        }
+
+        while (table->node[hash].key.word[0] != 0) {
+                hash = next_cell(table, hash);
+        }
+        fill_node(table, &table->node[hash], digest, src->key, src->element);
+}
+
+/*
+ * Sposta nell'array corrente al più steps nodi dell'array vecchio,
+ * lasciando al loro posto delle TOMBSTONE così che le ricerche
+ * nell'array vecchio non trovino copie superate. Quando l'array vecchio
+ * è stato svuotato viene ritirato.
+ */
+static
+void migrate(HashShard* shard, size_t steps) {
+        NodeArray* old = shard->old;
+        NodeArray* table = shard->table;
+        Node* node;
+        size_t end;
+
+        end = shard->migrated + steps;
+        if (end > old->size) {
+                end = old->size;
+        }
+
+        write_begin(shard);
+        for (; shard->migrated < end; shard->migrated++) {
+                node = &old->node[shard->migrated];
+                if (node->key.word[0] == 0) {
+                        continue;
+                }
+                place(table, node);
+                clear_node(old, node);
+        }
+        if (shard->migrated == old->size) {
+                store_release(&shard->old, NULL);
+        }
+        write_end(shard);
+
+        if (shard->old == NULL) {
+                retire(shard, old, 0);
+        }
+}
+
+/*
+ * Esegue fn su n_threads thread, compreso quello chiamante: ognuno riceve
+ * un struct worker con il lavoro comune e il proprio indice. Se un thread
+ * non può essere creato il suo lavoro viene svolto dal chiamante.
+ */
+struct worker {
+        void* job;
+        size_t id;
+};
+
+static
+void run_workers(void* job, size_t n_threads, void* (*fn)(void*)) {
+        pthread_t* threads;
+        struct worker* workers;
+        Boolean* started;
+        size_t t;
+
+        threads = malloc(n_threads * sizeof(pthread_t));
+        workers = malloc(n_threads * sizeof(struct worker));
+        started = calloc(n_threads, sizeof(Boolean));
+        if (threads == NULL || workers == NULL || started == NULL) {
+                free(threads);
+                free(workers);
+                free(started);
+                for (t = 0; t < n_threads; t++) {
+                        struct worker w = {job, t};
+                        fn(&w);
+                }
+                return;
+        }
+
+        for (t = 0; t < n_threads; t++) {
+                workers[t].job = job;
+                workers[t].id = t;
+                if (t > 0) {
+                        started[t] = pthread_create(&threads[t], NULL, fn,
+                                                    &workers[t]) == 0;
+                }
+        }
+        fn(&workers[0]);
+        for (t = 1; t < n_threads; t++) {
+                if (started[t]) {
+                        pthread_join(threads[t], NULL);
+                } else {
+                        fn(&workers[t]);
+                }
+        }
+
+        free(threads);
+        free(workers);
+        free(started);
+}
+
+/*
+ * Rehash parallelo: ogni worker sposta un intervallo contiguo di celle
+ * dell'array vecchio in quello nuovo, che nessun lettore vede ancora, e
+ * si aggiudica una cella libera scrivendo la prima parola della chiave con
+ * un compare-and-swap. Le chiavi occupano le celle in un ordine diverso da
+ * quello sequenziale, ma ognuna resta nel cluster che parte dalla sua
+ * cella di partenza, per cui la ricerca la trova comunque. Sotto
+ * REHASH_MIN_NODES celle per worker i thread costano più del rehash.
+ */
+#define REHASH_MIN_NODES 65536
+
+struct rehash {
+        NodeArray* from;
+        NodeArray* to;
+        size_t n_threads;
+};
+
+static
+void place_atomic(NodeArray* table, Node* src) {
+        size_t digest = node_digest(src);
+        size_t hash = bucket(table, digest);
+        size_t expected = 0;
+        Node* node;
+
+        while (!__atomic_compare_exchange_n(&table->node[hash].key.word[0],
+                                            &expected, src->key.word[0],
+                                            false, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                hash = next_cell(table, hash);
+                expected = 0;
+        }
+
+        node = &table->node[hash];
+        node->key.word[1] = src->key.word[1];
+        node->element = src->element;
+        set_ctrl(table, node, ctrl_hash(digest));
+}
+
+static
+void* rehash_range(void* arg) {
+        struct worker* w = arg;
+        struct rehash* r = w->job;
+        size_t i;
+
+        for (i = r->from->size * w->id / r->n_threads;
+             i < r->from->size * (w->id + 1) / r->n_threads; i++) {
+                if (r->from->node[i].key.word[0] != 0) {
+                        place_atomic(r->to, &r->from->node[i]);
+                }
+        }
+        return NULL;
+}
+
+/*
+ * Costruisce un nuovo array di new_size nodi e vi sposta i nodi non nulli
+ * con hash aggiornato alle nuove dimensioni. Chiavi ed elementi non vengono
+ * copiati: il nuovo array viene pubblicato con un'unica scrittura, per cui
+ * i lettori senza lock continuano a lavorare su quello vecchio, che viene
+ * ritirato, oppure sul nuovo.
+ * In modalità incrementale il nuovo array viene solo pubblicato accanto a
+ * quello vecchio, e i nodi vengono spostati poco per volta da migrate.
+ */
+static
+Boolean hash_resize(HashShard* shard, size_t new_size) {
+        NodeArray* table = shard->table;
+        NodeArray* copy;
+        struct rehash r;
+        size_t i;
+
+        TRACE_START(pause);
+        copy = new_node_array(new_size, table->ctrl != NULL, table->robin_hood);
+        if (copy == NULL) {
+                return false;
+        }
+
+        if (shard->incremental) {
+                write_begin(shard);
+                store_release(&shard->old, table);
+                shard->migrated = 0;
+                store_release(&shard->table, copy);
+                write_end(shard);
+                TRACE_SINCE(resize, pause);
+                return true;
+        }
+
+        // Con più thread di rehash divido le celle tra i worker, tranne
+        // con la politica Robin Hood, che sposta i nodi già collocati
+        r.n_threads = shard->resize_threads;
+        if (r.n_threads > table->size / REHASH_MIN_NODES) {
+                r.n_threads = table->size / REHASH_MIN_NODES;
+        }
+        if (r.n_threads > 1 && !table->robin_hood) {
+                r.from = table;
+                r.to = copy;
+                run_workers(&r, r.n_threads, rehash_range);
+        } else {
+                for (i = 0; i < table->size; i++) {
+                        if (table->node[i].key.word[0] != 0) {
+                                place(copy, &table->node[i]);
+                        }
+                }
+        }
+
+        // Assegno il nuovo array di nodi allo shard
+        store_release(&shard->table, copy);
+        retire(shard, table, 0);
+        TRACE_SINCE(resize, pause);
+
+        return true;
+}
+
+/*
+ * Questa funzione viene chiamata quando la dimensione dello shard
+ * supera il limite fissato. Raddoppia le dimensioni dello stesso.
+ */
+static
+Boolean hash_expand(HashShard* shard) {
+        size_t doubled;
+
+        // Raddoppio le dimensioni dello shard attuale
+        // e controllo che non siano troppo grandi
+        doubled = shard->table->size * 2;
+        if (doubled + doubled < doubled) {
+                return false;
+        }
+
+        if (!hash_resize(shard, doubled)) {
+                return false;
+        }
+        shard->expansions++;
+        return true;
+}
+
+/*
+ * Questa funzione viene chiamata quando la dimensione dello shard
+ * cala sotto il limite fissato. Dimezza le dimensioni dello stesso.
+ */
+static
+Boolean hash_shrink(HashShard* shard) {
+        size_t half;
+
+        // Dimezzo le dimensioni dello shard attuale
+        // e controllo che non siano troppo piccole
+        half = shard->table->size / 2;
+        if (half < 1) {
+                return false;
+        }
+
+        if (!hash_resize(shard, half)) {
+                return false;
+        }
+        shard->shrinks++;
+        return true;
+}
+
+/*
+ * Indica se elementi e TOMBSTONE lasciano meno di TABLE_MIN_EMPTY nodi
+ * EMPTY, per cui le ricerche di chiavi assenti attraversano quasi tutto
+ * l'array.
+ */
+static inline
+Boolean few_empty(HashShard* shard) {
+        NodeArray* table = shard->table;
+
+        return (shard->num_elements + table->tombstones) * 100 >=
+               (size_t) (100 - TABLE_MIN_EMPTY) * table->size;
+}
+
+/*
+ * Le ricerche di chiavi assenti attraversano i cluster fino a un nodo
+ * EMPTY, e le TOMBSTONE lasciate dalle rimozioni ne fanno parte senza
+ * essere contate tra gli elementi. Lo shard va quindi ricostruito alla
+ * stessa dimensione quando le TOMBSTONE superano la densità fissata, o
+ * quando restano pochi nodi EMPTY e le TOMBSTONE sono almeno
+ * TABLE_MIN_EMPTY nodi su 100: così ogni ricostruzione, che costa quanto
+ * l'array, viene ripagata da altrettante rimozioni.
+ */
+static inline
+Boolean needs_compaction(HashShard* shard) {
+        NodeArray* table = shard->table;
+
+        if (table->tombstones == 0) {
+                return false;
+        }
+        return table->tombstones * 100 >=
+               (size_t) shard->tombstone_density * table->size ||
+               (few_empty(shard) &&
+                table->tombstones * 100 >=
+                (size_t) TABLE_MIN_EMPTY * table->size);
+}
+
+/*
+ * Indica se lo shard va espanso prima di un inserimento: quando gli
+ * elementi raggiungono la densità di espansione, oppure quando restano
+ * pochi nodi EMPTY ma le TOMBSTONE sono troppo poche per una
+ * ricostruzione. Con densità di espansione oltre 100 - TABLE_MIN_EMPTY
+ * questo accade appena compare una TOMBSTONE in uno shard così pieno.
+ */
+static inline
+Boolean needs_expansion(HashShard* shard) {
+        if ((int) (shard->num_elements * 100 / shard->table->size) >=
+            shard->high_density) {
+                return true;
+        }
+        return shard->table->tombstones > 0 && few_empty(shard) &&
+               !needs_compaction(shard);
+}
+
+/*
+ * Ricostruisce lo shard alla stessa dimensione, eliminando le TOMBSTONE.
+ * La ricostruzione avviene in un nuovo array, come un ridimensionamento,
+ * perché i lettori senza lock possono stare attraversando quello attuale.
+ */
+static
+Boolean hash_compact_shard(HashShard* shard) {
+        if (!hash_resize(shard, shard->table->size)) {
+                return false;
+        }
+        shard->compactions++;
+        return true;
+}
+
+/*
+ * Porta lo shard a una dimensione in cui n elementi restano sotto la
+ * densità di espansione, con un solo ridimensionamento e senza migrazione
+ * incrementale. Una dimensione potenza di due resta tale, così che le
+ * celle continuino a essere scelte con la maschera.
+ */
+static
+Boolean reserve_shard(HashShard* shard, size_t n) {
+        size_t size = n * 100 / shard->high_density + 1;
+        size_t current = shard->table->size;
+        Boolean incremental;
+        Boolean retr;
+
+        if (shard->old != NULL) {
+                migrate(shard, shard->old->size);
+        }
+        if ((current & (current - 1)) == 0) {
+                while (current < size) {
+                        current <<= 1;
+                }
+                size = current;
+        }
+        if (size <= shard->table->size) {
+                return true;
+        }
+
+        incremental = shard->incremental;
+        shard->incremental = false;
+        retr = hash_resize(shard, size);
+        shard->incremental = incremental;
+        if (retr) {
+                shard->expansions++;
+        }
+        return retr;
+}
+
+/*
+ * Questa funzione agisce da wrapper della funzione d'inserimento.
+ * Controlla che la dimensione dello shard non superi il limite superiore
+ * fissato, ridimensionandolo in tal caso, ed effettua l'inserimento:
+ * ricerca e modifica avvengono con un solo probing. Va chiamata con la
+ * write lock dello shard acquisita.
+ */
+static
+int update_shard(HashTable* ht, HashShard* shard, size_t digest,
+                 SearchKey* k, HashUpdate fn, void* ctx, void** result) {
+        int retr;
+
+        // Una tabella aperta da un'immagine è in sola lettura
+        if (ht->image != NULL) {
+                return -1;
+        }
+
+        // Se è in corso un ridimensionamento incrementale ne
+        // porto avanti una parte
+        if (shard->old != NULL) {
+                migrate(shard, MIGRATE_STEP);
+        }
+
+        // Verifico che il numero di nodi all'interno dello shard non
+        // superi il valore di densità superiore stabilito, e che restino
+        // nodi EMPTY. In caso contrario procedo a espandere lo shard
+        // raddoppiandone le dimensioni
+        if (shard->old == NULL && needs_expansion(shard)) {
+                LOG(("Shard troppo PICCOLO, devo ridimensionare!\n"));
+                
+                if (hash_expand(shard)) {
+                        LOG(("Shard espanso! Nuova dimensione: %ld\n", 
+                                shard->table->size));
+                }
+        } else if (shard->old == NULL && needs_compaction(shard)) {
+                hash_compact_shard(shard);
+        }
+
+        // Utilizzo la funzione d'inserimento e controllo il valore restituito
+        retr = insert(ht, shard, digest, k, fn, ctx, result);
+        if (retr == 1) {
+                // Nel caso in cui sia uno, cioè di nuova chiave,
+                // incremento il numero di elementi dello shard
+                store_relaxed(&shard->num_elements, shard->num_elements + 1);
+        }
+
+        // Ritorno il valore restituito dall'inserimento
+        return retr;
+}
+
+/*
+ * Calcola il digest della chiave, sceglie lo shard e ne acquisisce la
+ * write lock per la durata dell'inserimento: una sola acquisizione per
+ * ricerca e modifica.
+ */
+static
+int update(HashTable* ht, const char* key, size_t len,
+           HashUpdate fn, void* ctx, void** result) {
+        HashShard* shard;
+        SearchKey k;
+        size_t digest;
+        int retr;
+
+        // Computo il digest della chiave data e scelgo lo shard
+        make_search_key(&k, key, len);
+        digest = key_digest(ht, &k);
+        shard = get_shard(ht, digest);
+        LOG(("Key: %.*s --> Digest: %lu\n", (int) len, key, digest));
+
+        // Acquisisco il lock per la scrittura
+        lock_shard(shard);
+        retr = update_shard(ht, shard, digest, &k, fn, ctx, result);
+        // Rilascio il lock
+        unlock_shard(shard);
+        return retr;
+}
+
+/*
+ * Funzioni di aggiornamento usate dalle varianti di hash_upsert.
+ */
+static
+void* update_replace(char* key, void* element, void* ctx) {
+        (void) key;
+        (void) element;
+        return ctx;
+}
+
+static
+void* update_absent(char* key, void* element, void* ctx) {
+        (void) key;
+        return element != NULL ? element : ctx;
+}
+
+struct compare_and_swap {
+        HashTable* ht;
+        void* expected;
+        void* desired;
+        int swapped;
+};
+
+static
+void* update_compare(char* key, void* element, void* ctx) {
+        struct compare_and_swap* cas = ctx;
+
+        (void) key;
+        if (element == NULL ? cas->expected != NULL :
+            cas->expected == NULL ||
+            !same_element(cas->ht, element, cas->expected)) {
+                return NULL;
+        }
+        cas->swapped = true;
+        return cas->desired;
+}
+
+/*
+ * Controlla che la chiave e l'elemento non siano nulli, in caso
+ * contrario ritorna -1, e sostituisce l'elemento.
+ */
+int hash_insert_n(HashTable* ht, const void* key, size_t len,
+                  void* element) {
+        void* result;
+
+        // Controllo che chiave ed elemento non siano nulli
+        if (key == NULL || element == NULL) {
+                return -1;
+        }
+
+        return update(ht, key, len, update_replace, element, &result);
+}
+
+int hash_upsert_n(HashTable* ht, const void* key, size_t len,
+                  HashUpdate fn, void* ctx) {
+        void* result;
+
+        if (key == NULL || fn == NULL) {
+                return -1;
+        }
+
+        return update(ht, key, len, fn, ctx, &result);
+}
+
+void* hash_get_or_insert_n(HashTable* ht, const void* key, size_t len,
+                           void* element) {
+        void* result = NULL;
+
+        if (key == NULL || element == NULL) {
+                return NULL;
+        }
+
+        // Come hash_get, l'elemento restituito viene letto dentro
+        // un'epoca, per cui resta valido finché il chiamante è nella sua
+        hash_epoch_enter();
+        if (update(ht, key, len, update_absent, element, &result) == -1) {
+                result = NULL;
+        }
+        hash_epoch_exit();
+        return result;
+}
+
+int hash_compare_and_swap_n(HashTable* ht, const void* key, size_t len,
+                            void* expected, void* desired) {
+        struct compare_and_swap cas = {ht, expected, desired, false};
+        void* result;
+
+        if (key == NULL || desired == NULL) {
+                return -1;
+        }
+
+        if (update(ht, key, len, update_compare, &cas, &result) == -1) {
+                return -1;
+        }
+        return cas.swapped;
+}
+
+/*
+ * Le varianti con chiavi terminate da NUL ne calcolano la lunghezza.
+ */
+int hash_insert(HashTable* ht, char* key, void* element) {
+        if (key == NULL) {
+                return -1;
+        }
+        return hash_insert_n(ht, key, strlen(key), element);
+}
+
+int hash_upsert(HashTable* ht, char* key, HashUpdate fn, void* ctx) {
+        if (key == NULL) {
+                return -1;
+        }
+        return hash_upsert_n(ht, key, strlen(key), fn, ctx);
+}
+
+void* hash_get_or_insert(HashTable* ht, char* key, void* element) {
+        if (key == NULL) {
+                return NULL;
+        }
+        return hash_get_or_insert_n(ht, key, strlen(key), element);
+}
+
+int hash_compare_and_swap(HashTable* ht, char* key,
+                          void* expected, void* desired) {
+        if (key == NULL) {
+                return -1;
+        }
+        return hash_compare_and_swap_n(ht, key, strlen(key),
+                                       expected, desired);
+}
+
+/*
+ * Immagine di una tabella: un'intestazione, la directory degli shard e per
+ * ogni shard un array di celle, seguiti dai byte di chiavi ed elementi.
+ * Tutti i campi sono interi a 64 bit e ogni riferimento è uno spostamento
+ * dall'inizio dell'immagine, per cui questa può essere mappata da file a
+ * qualunque indirizzo e letta senza conversioni. Le chiavi sono copiate
+ * nella cella come nei nodi, quelle lunghe con lo spostamento al posto
+ * del puntatore, e la cella ha in più il digest intero; una cella con
+ * chiave 0 è vuota. Le celle seguono il probing lineare senza TOMBSTONE,
+ * oppure, per le tabelle congelate, una funzione di hash perfetta minima:
+ * ogni shard ha tante celle quante chiavi e un pilota per ogni gruppo di
+ * chiavi.
+ */
+#define IMAGE_MAGIC "HASHIMG"
+#define IMAGE_VERSION 3
+#define IMAGE_BYTE_ORDER 0x01020304
+#define IMAGE_ALIGN 16
+
+#define IMAGE_LINEAR 0
+#define IMAGE_PERFECT 1
+
+typedef struct image_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint64_t size;
+        uint64_t layout;
+        uint64_t num_shards;
+        uint64_t seed;
+        uint64_t hash_function;
+        uint64_t ownership;
+        uint64_t element_size;
+        uint64_t num_elements;
+        uint64_t capacity;
+} ImageHeader;
+
+typedef struct image_shard {
+        uint64_t size;
+        uint64_t nodes;
+        uint64_t num_elements;
+        uint64_t buckets;
+        uint64_t pilots;
+} ImageShard;
+
+typedef struct image_node {
+        uint64_t hash;
+        NodeKey key;
+        uint64_t element;
+} ImageNode;
+
+/*
+ * Immagine servita da una tabella: mapped indica se base va liberata con
+ * munmap (immagine aperta da file) o con free (tabella congelata).
+ */
+struct hash_image {
+        const char* base;
+        size_t size;
+        Boolean mapped;
+        Boolean perfect;
+        const ImageHeader* header;
+        const ImageShard* shard;
+};
+
+/*
+ * Funzioni di hash che possono essere salvate nell'immagine, con il loro
+ * indice: quelle personalizzate non sono note a chi apre il file.
+ */
+static const HashFunction image_functions[] = {
+        hash_wyhash, hash_fnv1a, hash_sdbm, hash_djb2
+};
+
+#define IMAGE_FUNCTIONS (sizeof(image_functions) / sizeof(HashFunction))
+
+static inline
+size_t fast_range(size_t hash, size_t size) {
+        return (size_t) (((uint128) hash * size) >> 64);
+}
+
+static inline
+size_t image_bucket(size_t size, size_t digest) {
+        if ((size & (size - 1)) == 0) {
+                return digest & (size - 1);
+        }
+        return fast_range(digest, size);
+}
+
+/*
+ * Funzione di hash perfetta (schema CHD/PTHash): le chiavi di uno shard
+ * sono divise in gruppi di circa PERFECT_BUCKET_KEYS in base al digest, e
+ * a ogni gruppo è associato il pilota che, rimescolato con il digest,
+ * manda le sue chiavi in celle libere distinte.
+ */
+#define PERFECT_BUCKET_KEYS 4
+#define PERFECT_PILOT_MIX 0x9e3779b97f4a7c15UL
+
+static inline
+size_t perfect_cell(size_t digest, uint32_t pilot, size_t size) {
+        return fast_range(hash_mix(digest ^ (pilot * PERFECT_PILOT_MIX)),
+                          size);
+}
+
+static inline
+const ImageNode* image_nodes(struct hash_image* image, size_t s) {
+        return (const ImageNode*) (image->base + image->shard[s].nodes);
+}
+
+static inline
+const char* image_key(struct hash_image* image, const ImageNode* node) {
+        if (node->key.word[0] & INLINE_TAG) {
+                return node->key.bytes + 1;
+        }
+        return image->base + (node->key.word[0] >> 1);
+}
+
+/*
+ * Controlla che l'elemento di una cella sia contenuto nell'immagine: una
+ * stringa deve terminare prima della fine della mappatura, un blocco
+ * binario deve starci per intero.
+ */
+static inline
+Boolean image_element_valid(struct hash_image* image, const ImageNode* node) {
+        if (node->element >= image->size) {
+                return false;
+        }
+        if (image->header->ownership == HASH_OWN_STRING) {
+                return memchr(image->base + node->element, '\0',
+                              image->size - node->element) != NULL;
+        }
+        return image->header->element_size <= image->size - node->element;
+}
+
+/*
+ * Controlla chiave ed elemento di una cella occupata, per le scansioni
+ * che li restituiscono senza confrontarli con una chiave cercata.
+ */
+static inline
+Boolean image_cell_valid(struct hash_image* image, const ImageNode* node) {
+        size_t len = key_length((NodeKey*) &node->key);
+
+        if ((node->key.word[0] & INLINE_TAG) == 0 &&
+            (len > image->size ||
+             (node->key.word[0] >> 1) > image->size - len)) {
+                return false;
+        }
+        return image_element_valid(image, node);
+}
+
+/*
+ * Confronta la chiave cercata con quella di una cella: una chiave corta
+ * si trova solo nella cella. Gli spostamenti e gli elementi vengono
+ * confrontati con la dimensione dell'immagine, così che un file
+ * danneggiato non faccia leggere fuori dalla mappatura.
+ */
+static inline
+Boolean image_match(struct hash_image* image, const ImageNode* node,
+                    size_t digest, SearchKey* k) {
+        if (node->hash != digest) {
+                return false;
+        }
+        if (k->len <= HASH_INLINE_KEY) {
+                if (node->key.word[0] != k->node.word[0] ||
+                    node->key.word[1] != search_word(k, digest)) {
+                        return false;
+                }
+        } else if ((node->key.word[0] & INLINE_TAG) != 0 ||
+                   node->key.word[1] != search_word(k, digest) ||
+                   k->len > image->size ||
+                   (node->key.word[0] >> 1) > image->size - k->len ||
+                   memcmp(image->base + (node->key.word[0] >> 1), k->str,
+                          k->len) != 0) {
+                return false;
+        }
+        // L'elemento viene controllato solo per la chiave trovata
+        return image_element_valid(image, node);
+}
+
+/*
+ * Cerca la chiave nelle celle dello shard a cui appartiene il digest.
+ * L'immagine non cambia mai, per cui non servono né lock né epoche. Con
+ * la funzione di hash perfetta viene letta una sola cella.
+ */
+static
+void* image_get(HashTable* ht, size_t digest, SearchKey* k) {
+        struct hash_image* image = ht->image;
+        const ImageShard* shard;
+        const ImageNode* nodes;
+        const uint32_t* pilots;
+        size_t s = get_shard(ht, digest) - ht->shard;
+        size_t pos, probes;
+
+        shard = &image->shard[s];
+        nodes = image_nodes(image, s);
+        if (image->perfect) {
+                if (shard->size == 0) {
+                        return NULL;
+                }
+                pilots = (const uint32_t*) (image->base + shard->pilots);
+                pos = perfect_cell(digest,
+                                   pilots[fast_range(digest, shard->buckets)],
+                                   shard->size);
+                if (!image_match(image, &nodes[pos], digest, k)) {
+                        return NULL;
+                }
+                return (void*) (image->base + nodes[pos].element);
+        }
+
+        pos = image_bucket(shard->size, digest);
+        for (probes = 0; probes < shard->size && nodes[pos].key.word[0] != 0;
+             probes++) {
+                if (image_match(image, &nodes[pos], digest, k)) {
+                        return (void*) (image->base + nodes[pos].element);
+                }
+                pos = pos + 1 == shard->size ? 0 : pos + 1;
+        }
+        return NULL;
+}
+
+/*
+ * Richiede alla cache la cella di partenza del digest oppure, con la
+ * funzione di hash perfetta, il pilota del suo gruppo e poi, con cell,
+ * la cella scelta dal pilota, che va quindi letto prima.
+ */
+static inline
+void image_prefetch(HashTable* ht, size_t digest, Boolean cell) {
+        struct hash_image* image = ht->image;
+        size_t s = get_shard(ht, digest) - ht->shard;
+        const ImageShard* shard = &image->shard[s];
+        const uint32_t* pilots;
+        size_t pos;
+
+        if (shard->size == 0) {
+                return;
+        }
+        if (!image->perfect) {
+                if (!cell) {
+                        pos = image_bucket(shard->size, digest);
+                        __builtin_prefetch(&image_nodes(image, s)[pos]);
+                }
+                return;
+        }
+
+        pilots = (const uint32_t*) (image->base + shard->pilots);
+        pos = fast_range(digest, shard->buckets);
+        if (!cell) {
+                __builtin_prefetch(&pilots[pos]);
+                return;
+        }
+        pos = perfect_cell(digest, pilots[pos], shard->size);
+        __builtin_prefetch(&image_nodes(image, s)[pos]);
+}
+
+/*
+ * La ricerca non acquisisce alcun lock: legge l'array corrente dello shard
+ * (e quello vecchio durante un ridimensionamento incrementale) e ripete la
+ * ricerca se nel frattempo uno scrittore ha modificato i nodi. Va chiamata
+ * all'interno di un'epoca.
+ */
+static
+void* get_shard_element(HashShard* shard, size_t digest, SearchKey* k) {
+        Node* found;
+        void* element;
+        unsigned long seq;
+
+        do {
+                seq = read_begin(shard);
+                element = NULL;
+
+                // Controllo che il numero di elementi sia > 1 
+                // così da evitare il blocco di codice seguente
+                if (load_relaxed(&shard->num_elements) == 0) {
+                        continue;
+                }
+
+                // Cerco il nodo indicato: se esiste è popolato e
+                // restituisco l'elemento
+                found = lookup(load_acquire(&shard->table),
+                               load_acquire(&shard->old),
+                               digest,
+                               k);
+                if (found != NULL) {
+                        element = load_acquire(&found->element);
+                }
+        } while (read_retry(shard, seq));
+
+        return element;
+}
+
+void* hash_get_n(HashTable* ht, const void* key, size_t len) {
+        HashShard* shard;
+        void* element;
+        SearchKey k;
+        size_t digest;
+
+        // Viene computato il digest della chiave fornita
+        make_search_key(&k, key, len);
+        digest = key_digest(ht, &k);
+        shard = get_shard(ht, digest);
+        LOG(("Sto cercando l'elemento di chiave %.*s\n", (int) len, key));
+
+        // Una tabella aperta da un'immagine viene letta dal file mappato
+        if (ht->image != NULL) {
+                return image_get(ht, digest, &k);
+        }
+
+        // Senza altri thread nessuno può liberare la memoria letta
+        if (shard->local) {
+                return get_shard_element(shard, digest, &k);
+        }
+
+        hash_epoch_enter();
+        element = get_shard_element(shard, digest, &k);
+        hash_epoch_exit();
+
+        return element;
+}
+
+void* hash_get(HashTable* ht, char* key) {
+        return hash_get_n(ht, key, strlen(key));
+}
+
+/*
+ * Rimuove la chiave dallo shard, riducendolo se necessario, e ne
+ * restituisce l'elemento oppure NULL. Va chiamata con la write lock dello
+ * shard acquisita.
+ */
+static
+void* remove_shard(HashTable* ht, HashShard* shard, size_t digest,
+                   SearchKey* k) {
+        Node* found;
+        void* element;
+        char* found_key;
+        size_t found_len;
+
+        // Se il numero di elementi è 0 non vi sono nodi da rimuovere,
+        // come in una tabella aperta da un'immagine, che è in sola lettura
+        if (shard->num_elements < 1 || ht->image != NULL) {
+                return NULL;
+        }
+
+        // Se è in corso un ridimensionamento incrementale ne
+        // porto avanti una parte
+        if (shard->old != NULL) {
+                migrate(shard, MIGRATE_STEP);
+        }
+
+        // Verifico che il numero di nodi all'interno dello shard non
+        // sia al di sotto del valore di densità superiore stabilito.
+        // In caso contrario procedo a espandere lo shard dimezzandone
+        // le dimensioni
+        if (shard->old == NULL &&
+            (int) (shard->num_elements*100/shard->table->size) <=
+            shard->low_density) {
+                LOG(("Shard troppo GRANDE, devo ridimensionare!\n"));
+
+                if (hash_shrink(shard)) {
+                        LOG(("Shard rimpicciolito! Nuova dimensione: "
+                             "%ld\n", shard->table->size));
+                }
+        } else if (shard->old == NULL && needs_compaction(shard)) {
+                hash_compact_shard(shard);
+        }
+
+        // Cerco il nodo indicato: se non esiste non c'è nulla da rimuovere,
+        // altrimenti procedo a rimuoverlo e decrementare il numero di
+        // elementi
+        found = lookup(shard->table, shard->old, digest, k);
+        if (found == NULL) {
+                return NULL;
+        }
+
+        found_key = key_pointer(&found->key);
+        found_len = key_length(&found->key);
+        element = found->element;
+
+        // Pongo la chiave NULL e l'elemento a TOMBSTONE, oppure con la
+        // politica Robin Hood riporto indietro i nodi successivi
+        write_begin(shard);
+        if (owner(shard, found) == shard->table && shard->table->robin_hood) {
+                robin_hood_remove(shard->table, found);
+        } else {
+                clear_node(owner(shard, found), found);
+        }
+        write_end(shard);
+
+        // Decremento il numero di elementi e ritiro chiave ed elemento,
+        // che restano validi per i lettori ancora nella loro epoca
+        store_relaxed(&shard->num_elements, shard->num_elements - 1);
+        release_entry(ht, shard, found_key, found_len, element);
+
+        return element;
+}
+
+void* hash_remove_n(HashTable* ht, const void* key, size_t len) {
+        HashShard* shard;
+        void* element;
+        SearchKey k;
+        size_t digest;
+
+        // Computo l'hash della chiave data e scelgo lo shard
+        make_search_key(&k, key, len);
+        digest = key_digest(ht, &k);
+        shard = get_shard(ht, digest);
+        LOG(("Inizio la rimozione dell'elemento con chiave: %lu\n", digest));
+
+        // Acquisisco il lock dentro un'epoca, come hash_get, così che
+        // l'elemento ritirato non venga liberato prima che il chiamante
+        // esca dalla propria
+        hash_epoch_enter();
+        lock_shard(shard);
+        element = remove_shard(ht, shard, digest, &k);
+        // Rilascio il lock
+        unlock_shard(shard);
+        hash_epoch_exit();
+        return element;
+}
+
+void* hash_remove(HashTable* ht, char* key) {
+        return hash_remove_n(ht, key, strlen(key));
+}
+
+/*
+ * Operazioni a gruppi: le chiavi vengono elaborate a blocchi di
+ * BATCH_CHUNK. Di ogni blocco vengono calcolati prima tutti i digest,
+ * quindi viene richiesta alla cache la cella di partenza di ogni chiave (e
+ * il suo byte di controllo), così che i miss delle diverse chiavi si
+ * sovrappongano invece di susseguirsi, e solo dopo vengono risolte le
+ * ricerche. Il blocco viene elaborato all'interno di un'epoca, così che
+ * gli array letti per il prefetch non vengano liberati nel frattempo.
+ */
+#define BATCH_CHUNK 32
+
+typedef struct batch {
+        SearchKey key[BATCH_CHUNK];
+        size_t digest[BATCH_CHUNK];
+        HashShard* shard[BATCH_CHUNK];
+        size_t order[BATCH_CHUNK];
+        size_t n;
+} Batch;
+
+static inline
+void prefetch_home(HashShard* shard, size_t digest) {
+        NodeArray* table = load_acquire(&shard->table);
+        size_t pos = bucket(table, digest);
+
+        if (table->ctrl != NULL) {
+                __builtin_prefetch(table->ctrl + pos);
+        }
+        __builtin_prefetch(&table->node[pos]);
+}
+
+/*
+ * Prepara le chiavi del blocco che inizia da first, ne calcola digest e
+ * shard e ne richiede le celle di partenza. Per le scritture gli indici
+ * vengono anche ordinati per shard, in modo stabile così che le
+ * operazioni sulla stessa chiave restino nell'ordine dato.
+ */
+static
+void prepare_batch(HashTable* ht, Batch* b, char** keys, size_t* lens,
+                   size_t first, size_t n, Boolean by_shard) {
+        size_t i, j, index;
+
+        b->n = n - first < BATCH_CHUNK ? n - first : BATCH_CHUNK;
+        for (i = 0; i < b->n; i++) {
+                index = first + i;
+                make_search_key(&b->key[i], keys[index],
+                                lens != NULL ? lens[index] :
+                                               strlen(keys[index]));
+                b->digest[i] = key_digest(ht, &b->key[i]);
+                b->shard[i] = get_shard(ht, b->digest[i]);
+        }
+
+        for (i = 0; i < b->n; i++) {
+                if (ht->image != NULL) {
+                        image_prefetch(ht, b->digest[i], false);
+                } else {
+                        prefetch_home(b->shard[i], b->digest[i]);
+                }
+        }
+        for (i = 0; i < b->n && ht->image != NULL; i++) {
+                image_prefetch(ht, b->digest[i], true);
+        }
+
+        for (i = 0; i < b->n && by_shard; i++) {
+                index = i;
+                for (j = i; j > 0 && b->shard[b->order[j - 1]] >
+                                     b->shard[index]; j--) {
+                        b->order[j] = b->order[j - 1];
+                }
+                b->order[j] = index;
+        }
+}
+
+size_t hash_get_batch(HashTable* ht, char** keys, size_t* lens, size_t n,
+                      void** elements) {
+        Batch b;
+        size_t first, i;
+        size_t found = 0;
+
+        for (first = 0; first < n; first += BATCH_CHUNK) {
+                hash_epoch_enter();
+                prepare_batch(ht, &b, keys, lens, first, n, false);
+                for (i = 0; i < b.n; i++) {
+                        if (ht->image != NULL) {
+                                elements[first + i] = image_get(ht,
+                                                                b.digest[i],
+                                                                &b.key[i]);
+                        } else {
+                                elements[first + i] =
+                                        get_shard_element(b.shard[i],
+                                                          b.digest[i],
+                                                          &b.key[i]);
+                        }
+                        found += elements[first + i] != NULL;
+                }
+                hash_epoch_exit();
+        }
+
+        return found;
+}
+
+/*
+ * Le scritture di un blocco acquisiscono il lock di ogni shard una volta
+ * sola, per tutte le chiavi del blocco che gli appartengono.
+ */
+size_t hash_insert_batch(HashTable* ht, char** keys, size_t* lens, size_t n,
+                         void** elements, int* results) {
+        HashShard* shard;
+        Batch b;
+        void* result;
+        size_t first, i, index;
+        size_t inserted = 0;
+        int retr;
+
+        for (first = 0; first < n; first += BATCH_CHUNK) {
+                hash_epoch_enter();
+                prepare_batch(ht, &b, keys, lens, first, n, true);
+                shard = NULL;
+                for (i = 0; i < b.n; i++) {
+                        index = b.order[i];
+                        if (b.shard[index] != shard) {
+                                if (shard != NULL) {
+                                        unlock_shard(shard);
+                                }
+                                shard = b.shard[index];
+                                lock_shard(shard);
+                        }
+                        retr = -1;
+                        if (elements[first + index] != NULL) {
+                                retr = update_shard(ht, shard,
+                                                    b.digest[index],
+                                                    &b.key[index],
+                                                    update_replace,
+                                                    elements[first + index],
+                                                    &result);
+                        }
+                        inserted += retr == 1;
+                        if (results != NULL) {
+                                results[first + index] = retr;
+                        }
+                }
+                if (shard != NULL) {
+                        unlock_shard(shard);
+                }
+                hash_epoch_exit();
+        }
+
+        return inserted;
+}
+
+size_t hash_remove_batch(HashTable* ht, char** keys, size_t* lens, size_t n,
+                         void** elements) {
+        HashShard* shard;
+        Batch b;
+        void* element;
+        size_t first, i, index;
+        size_t removed = 0;
+
+        for (first = 0; first < n; first += BATCH_CHUNK) {
+                hash_epoch_enter();
+                prepare_batch(ht, &b, keys, lens, first, n, true);
+                shard = NULL;
+                for (i = 0; i < b.n; i++) {
+                        index = b.order[i];
+                        if (b.shard[index] != shard) {
+                                if (shard != NULL) {
+                                        unlock_shard(shard);
+                                }
+                                shard = b.shard[index];
+                                lock_shard(shard);
+                        }
+                        element = remove_shard(ht, shard, b.digest[index],
+                                               &b.key[index]);
+                        removed += element != NULL;
+                        if (elements != NULL) {
+                                elements[first + index] = element;
+                        }
+                }
+                if (shard != NULL) {
+                        unlock_shard(shard);
+                }
+                hash_epoch_exit();
+        }
+
+        return removed;
+}
+
+/*
+ * Il numero di elementi viene tenuto da ogni shard sotto il proprio lock:
+ * basta sommare i contatori, letti atomicamente, senza visitare i nodi.
+ */
+size_t hash_num_elements(HashTable* ht) {
+        size_t busy_nodes = 0;
+        size_t s;
+
+        if (ht->image != NULL) {
+                return ht->image->header->num_elements;
+        }
+        for (s = 0; s < ht->num_shards; s++) {
+                busy_nodes += load_relaxed(&ht->shard[s].num_elements);
+        }
+        return busy_nodes;
+}
+
+size_t hash_size(HashTable* ht) {
+        size_t size = 0;
+        size_t s;
+
+        if (ht->image != NULL) {
+                return ht->image->header->capacity;
+        }
+        hash_epoch_enter();
+        for (s = 0; s < ht->num_shards; s++) {
+                size += load_acquire(&ht->shard[s].table)->size;
+        }
+        hash_epoch_exit();
+        return size;
+}
+
+/*
+ * Aggiunge alle statistiche i nodi di un array: la lunghezza di probing
+ * di ogni chiave è la sua distanza dalla cella di partenza, un cluster è
+ * una sequenza di nodi non EMPTY, che la ricerca deve attraversare.
+ * Il primo cluster può proseguire da quello che chiude l'array.
+ */
+static
+void array_stats(NodeArray* table, HashStats* out, size_t* total_probe) {
+        Node* node;
+        size_t probe;
+        size_t first = 0;
+        size_t run = 0;
+        Boolean seen_empty = false;
+        size_t i;
+
+        for (i = 0; i < table->size; i++) {
+                node = &table->node[i];
+                if (node->key.word[0] == 0) {
+                        if (node->element == EMPTY) {
+                                if (!seen_empty) {
+                                        first = run;
+                                        seen_empty = true;
+                                }
+                                if (run > out->longest_cluster) {
+                                        out->longest_cluster = run;
+                                }
+                                run = 0;
+                                continue;
+                        }
+                        out->tombstones++;
+                        run++;
+                        continue;
+                }
+
+                run++;
+                probe = displacement(table, i, node_digest(node));
+                out->probe_histogram[probe < HASH_STATS_PROBES - 1 ?
+                                     probe : HASH_STATS_PROBES - 1]++;
+                *total_probe += probe;
+                if (probe > out->max_probe) {
+                        out->max_probe = probe;
+                }
+        }
+
+        // L'ultimo cluster prosegue con il primo, a meno che l'array non
+        // contenga alcun nodo EMPTY
+        run = seen_empty ? run + first : run;
+        if (run > out->longest_cluster) {
+                out->longest_cluster = run;
+        }
+}
+
+void hash_stats(HashTable* ht, HashStats* out) {
+        HashShard* shard;
+        size_t total_probe = 0;
+        size_t s;
+
+        memset(out, 0, sizeof(HashStats));
+        if (ht->image != NULL) {
+                out->capacity = ht->image->header->capacity;
+                out->elements = ht->image->header->num_elements;
+        }
+        for (s = 0; s < ht->num_shards && ht->image == NULL; s++) {
+                shard = &ht->shard[s];
+                rdlock(&shard->lock);
+                out->capacity += shard->table->size;
+                out->elements += shard->num_elements;
+                out->expansions += shard->expansions;
+                out->shrinks += shard->shrinks;
+                out->compactions += shard->compactions;
+                array_stats(shard->table, out, &total_probe);
+                if (shard->old != NULL) {
+                        array_stats(shard->old, out, &total_probe);
+                }
+                rwlunlock(&shard->lock);
+        }
+
+        if (out->capacity > 0) {
+                out->load_factor = (double) out->elements / out->capacity;
+        }
+        if (out->elements > 0) {
+                out->mean_probe = (double) total_probe / out->elements;
+        }
+}
+
+/*
+ * Le chiavi si distribuiscono tra gli shard solo in media: a ognuno viene
+ * riservato un margine di circa il 3%, che supera ampiamente lo scarto
+ * tipico già da poche migliaia di chiavi.
+ */
+int hash_reserve(HashTable* ht, size_t n) {
+        HashShard* shard;
+        size_t per_shard = n / ht->num_shards;
+        int retr = 0;
+        size_t s;
+
+        if (ht->image != NULL) {
+                return -1;
+        }
+        if (ht->num_shards > 1) {
+                per_shard += per_shard / 32 + 64;
+        }
+
+        for (s = 0; s < ht->num_shards; s++) {
+                shard = &ht->shard[s];
+                wrlock(&shard->lock);
+                if (!reserve_shard(shard, per_shard)) {
+                        retr = -1;
+                }
+                rwlunlock(&shard->lock);
+        }
+
+        return retr;
+}
+
+/*
+ * Caricamento in blocco: i digest di tutte le chiavi vengono calcolati in
+ * parallelo, gli indici delle chiavi vengono raggruppati per shard con un
+ * counting sort stabile, e infine ogni thread prende uno shard alla volta,
+ * ne acquisisce il lock una sola volta, lo porta alla dimensione finale e
+ * vi inserisce tutte le sue chiavi nell'ordine dato.
+ */
+struct bulk_load {
+        HashTable* ht;
+        char** keys;
+        size_t* lens;
+        void** elements;
+        size_t n;
+        size_t* digest;
+        size_t* order;
+        size_t* start;
+        size_t n_threads;
+        size_t next_shard;
+        int failed;
+};
+
+static inline
+size_t bulk_length(struct bulk_load* b, size_t i) {
+        return b->lens != NULL ? b->lens[i] : strlen(b->keys[i]);
+}
+
+static
+void* bulk_hash(void* arg) {
+        struct worker* w = arg;
+        struct bulk_load* b = w->job;
+        SearchKey k;
+        size_t i;
+
+        for (i = b->n * w->id / b->n_threads;
+             i < b->n * (w->id + 1) / b->n_threads; i++) {
+                make_search_key(&k, b->keys[i], bulk_length(b, i));
+                b->digest[i] = key_digest(b->ht, &k);
+        }
+        return NULL;
+}
+
+/*
+ * Conta i digest distinti delle chiavi dello shard s che hanno un
+ * elemento, così che lo shard venga riservato per le chiavi nuove e non
+ * per i loro duplicati. Usa un insieme temporaneo di digest a
+ * indirizzamento aperto, in cui 0 indica una cella libera; se non può
+ * allocarlo restituisce il numero delle chiavi.
+ */
+static
+size_t bulk_distinct(struct bulk_load* b, size_t s) {
+        size_t count = b->start[s + 1] - b->start[s];
+        size_t size = 2;
+        size_t distinct = 0;
+        size_t* set;
+        size_t i, pos, digest;
+        Boolean zero = false;
+
+        while (size < 2 * count) {
+                size <<= 1;
+        }
+        set = calloc(size, sizeof(size_t));
+        if (set == NULL) {
+                return count;
+        }
+
+        for (i = b->start[s]; i < b->start[s + 1]; i++) {
+                if (b->elements[b->order[i]] == NULL) {
+                        continue;
+                }
+                digest = b->digest[b->order[i]];
+                if (digest == 0) {
+                        distinct += !zero;
+                        zero = true;
+                        continue;
+                }
+                pos = hash_mix(digest) & (size - 1);
+                while (set[pos] != 0 && set[pos] != digest) {
+                        pos = (pos + 1) & (size - 1);
+                }
+                if (set[pos] == 0) {
+                        set[pos] = digest;
+                        distinct++;
+                }
+        }
+
+        free(set);
+        return distinct;
+}
+
+static
+void* bulk_insert(void* arg) {
+        struct worker* w = arg;
+        struct bulk_load* b = w->job;
+        HashShard* shard;
+        SearchKey k;
+        void* result;
+        size_t s, i, index;
+
+        while ((s = __atomic_fetch_add(&b->next_shard, 1, __ATOMIC_RELAXED))
+               < b->ht->num_shards) {
+                shard = &b->ht->shard[s];
+                wrlock(&shard->lock);
+                if (!reserve_shard(shard, shard->num_elements +
+                                          bulk_distinct(b, s))) {
+                        store_relaxed(&b->failed, true);
+                }
+                for (i = b->start[s]; i < b->start[s + 1]; i++) {
+                        index = b->order[i];
+                        if (b->elements[index] == NULL) {
+                                continue;
+                        }
+                        make_search_key(&k, b->keys[index],
+                                        bulk_length(b, index));
+                        if (update_shard(b->ht, shard, b->digest[index], &k,
+                                         update_replace, b->elements[index],
+                                         &result) == -1) {
+                                store_relaxed(&b->failed, true);
+                        }
+                }
+                rwlunlock(&shard->lock);
+        }
+        return NULL;
+}
+
+int hash_bulk_load(HashTable* ht, char** keys, size_t* lens,
+                   void** elements, size_t n, size_t n_threads) {
+        struct bulk_load b;
+        size_t i, s;
+
+        if (ht->image != NULL) {
+                return -1;
+        }
+        if (n == 0) {
+                return 0;
+        }
+
+        b.ht = ht;
+        b.keys = keys;
+        b.lens = lens;
+        b.elements = elements;
+        b.n = n;
+        b.n_threads = n_threads > 0 ? n_threads : 1;
+        b.next_shard = 0;
+        b.failed = false;
+        b.digest = malloc(n * sizeof(size_t));
+        b.order = malloc(n * sizeof(size_t));
+        b.start = calloc(ht->num_shards + 1, sizeof(size_t));
+        if (b.digest == NULL || b.order == NULL || b.start == NULL) {
+                free(b.digest);
+                free(b.order);
+                free(b.start);
+                perror("Errore allocazione del caricamento in blocco");
+                return -1;
+        }
+
+        run_workers(&b, b.n_threads, bulk_hash);
+
+        // Conto le chiavi di ogni shard: start[s + 1] diventa la fine
+        // della parte di order che spetta allo shard s
+        for (i = 0; i < n; i++) {
+                b.start[get_shard(ht, b.digest[i]) - ht->shard + 1]++;
+        }
+        for (s = 1; s <= ht->num_shards; s++) {
+                b.start[s] += b.start[s - 1];
+        }
+
+        // Distribuisco gli indici partendo dall'ultimo, così che ogni
+        // shard li riceva nell'ordine dato: alla fine start[s + 1] è
+        // l'inizio della parte dello shard s
+        for (i = n; i > 0; i--) {
+                s = get_shard(ht, b.digest[i - 1]) - ht->shard;
+                b.order[--b.start[s + 1]] = i - 1;
+        }
+        memmove(b.start, b.start + 1, ht->num_shards * sizeof(size_t));
+        b.start[ht->num_shards] = n;
+
+        run_workers(&b, b.n_threads, bulk_insert);
+
+        free(b.digest);
+        free(b.order);
+        free(b.start);
+        return b.failed ? -1 : 0;
+}
+
+/*
+ * Le scansioni di un'immagine leggono direttamente le sue celle: it->pos
+ * è la prossima cella dello shard it->shard.
+ */
+static
+int image_next(HashIter* it, char** key, size_t* len, void** element) {
+        struct hash_image* image = it->ht->image;
+        const ImageNode* node;
+
+        for (; it->shard < it->ht->num_shards; it->shard++, it->pos = 0) {
+                while (it->pos < image->shard[it->shard].size) {
+                        node = &image_nodes(image, it->shard)[it->pos++];
+                        if (node->key.word[0] == 0 ||
+                            !image_cell_valid(image, node)) {
+                                continue;
+                        }
+                        *key = (char*) image_key(image, node);
+                        if (len != NULL) {
+                                *len = key_length((NodeKey*) &node->key);
+                        }
+                        if (element != NULL) {
+                                *element = (void*) (image->base +
+                                                    node->element);
+                        }
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+static
+size_t image_for_each_range(HashTable* ht, size_t part, size_t nparts,
+                            HashVisit fn, void* ctx) {
+        struct hash_image* image = ht->image;
+        const ImageNode* nodes;
+        size_t visited = 0;
+        size_t s, i, lo, hi;
+
+        for (s = 0; s < ht->num_shards; s++) {
+                nodes = image_nodes(image, s);
+                lo = image->shard[s].size * part / nparts;
+                hi = image->shard[s].size * (part + 1) / nparts;
+                for (i = lo; i < hi; i++) {
+                        if (nodes[i].key.word[0] == 0 ||
+                            !image_cell_valid(image, &nodes[i])) {
+                                continue;
+                        }
+                        visited++;
+                        if (fn(image_key(image, &nodes[i]),
+                               key_length((NodeKey*) &nodes[i].key),
+                               (void*) (image->base + nodes[i].element),
+                               ctx) != 0) {
+                                return visited;
+                        }
+                }
+        }
+        return visited;
+}
+
+/*
+ * Il cursore visita uno shard alla volta: sotto la read lock ne copia i
+ * nodi occupati, di entrambi gli array durante un ridimensionamento
+ * incrementale, e la rilascia subito, così che gli scrittori non restino
+ * bloccati mentre il chiamante elabora le chiavi. Le chiavi lunghe e gli
+ * elementi restano validi perché il cursore resta in un'epoca fino a
+ * hash_iter_end; quelle corte vengono copiate con il nodo.
+ */
+static
+int snapshot_shard(HashIter* it) {
+        HashShard* shard = &it->ht->shard[it->shard];
+        NodeArray* arrays[2];
+        Node* entries;
+        size_t a, i;
+
+        rdlock(&shard->lock);
+        if (shard->num_elements > it->capacity) {
+                entries = realloc(it->entries,
+                                  shard->num_elements * sizeof(Node));
+                if (entries == NULL) {
+                        rwlunlock(&shard->lock);
+                        perror("Errore allocazione del cursore");
+                        return -1;
+                }
+                it->entries = entries;
+                it->capacity = shard->num_elements;
+        }
+
+        it->len = 0;
+        it->pos = 0;
+        arrays[0] = shard->table;
+        arrays[1] = shard->old;
+        for (a = 0; a < 2 && arrays[a] != NULL; a++) {
+                for (i = 0; i < arrays[a]->size &&
+                            it->len < it->capacity; i++) {
+                        if (arrays[a]->node[i].key.word[0] != 0) {
+                                it->entries[it->len++] = arrays[a]->node[i];
+                        }
+                }
+        }
+        rwlunlock(&shard->lock);
+        return 0;
+}
+
+void hash_iter_begin(HashTable* ht, HashIter* it) {
+        it->ht = ht;
+        it->shard = 0;
+        it->entries = NULL;
+        it->capacity = 0;
+        it->len = 0;
+        it->pos = 0;
+        it->started = false;
+        hash_epoch_enter();
+}
+
+int hash_iter_next(HashIter* it, char** key, size_t* len, void** element) {
+        Node* entry;
+
+        if (it->ht->image != NULL) {
+                return image_next(it, key, len, element);
+        }
+
+        // Passo allo shard successivo quando quello corrente è esaurito
+        while (it->pos == it->len) {
+                if (it->started) {
+                        it->shard++;
+                }
+                it->started = true;
+                if (it->shard >= it->ht->num_shards) {
+                        it->len = 0;
+                        it->pos = 0;
+                        return 0;
+                }
+                if (snapshot_shard(it) != 0) {
+                        return -1;
+                }
+        }
+
+        entry = &it->entries[it->pos++];
+        *key = key_string(&entry->key);
+        if (len != NULL) {
+                *len = key_length(&entry->key);
+        }
+        if (element != NULL) {
+                *element = entry->element;
+        }
+        return 1;
+}
+
+void hash_iter_end(HashIter* it) {
+        free(it->entries);
+        it->entries = NULL;
+        it->capacity = 0;
+        it->len = 0;
+        it->pos = 0;
+        hash_epoch_exit();
+}
+
+/*
+ * Ogni parte visita lo stesso intervallo di celle di ogni array di ogni
+ * shard, tenendo la read lock dello shard: più parti possono leggere lo
+ * stesso shard insieme, mentre gli scrittori attendono la fine
+ * dell'intervallo.
+ */
+size_t hash_for_each_range(HashTable* ht, size_t part, size_t nparts,
+                           HashVisit fn, void* ctx) {
+        HashShard* shard;
+        NodeArray* arrays[2];
+        Node* node;
+        size_t visited = 0;
+        size_t s, a, i, lo, hi;
+
+        if (fn == NULL || nparts == 0 || part >= nparts) {
+                return 0;
+        }
+        if (ht->image != NULL) {
+                return image_for_each_range(ht, part, nparts, fn, ctx);
+        }
+
+        for (s = 0; s < ht->num_shards; s++) {
+                shard = &ht->shard[s];
+                rdlock(&shard->lock);
+                arrays[0] = shard->table;
+                arrays[1] = shard->old;
+                for (a = 0; a < 2 && arrays[a] != NULL; a++) {
+                        lo = arrays[a]->size * part / nparts;
+                        hi = arrays[a]->size * (part + 1) / nparts;
+                        for (i = lo; i < hi; i++) {
+                                node = &arrays[a]->node[i];
+                                if (node->key.word[0] == 0) {
+                                        continue;
+                                }
+                                visited++;
+                                if (fn(key_string(&node->key),
+                                       key_length(&node->key),
+                                       node->element, ctx) != 0) {
+                                        rwlunlock(&shard->lock);
+                                        return visited;
+                                }
+                        }
+                }
+                rwlunlock(&shard->lock);
+        }
+
+        return visited;
+}
+
+/*
+ * Fusione: ogni chiave della tabella sorgente viene inserita nella
+ * destinazione con la funzione d'aggiornamento merge_update, che per le
+ * chiavi già presenti chiede l'elemento da tenere alla funzione combine.
+ * La sorgente viene letta con hash_for_each_range, sotto la read lock di
+ * ogni suo shard.
+ */
+struct merge {
+        HashTable* dst;
+        HashMerge combine;
+        void* ctx;
+        void* element;
+        Boolean failed;
+};
+
+static
+void* merge_update(char* key, void* element, void* ctx) {
+        struct merge* m = ctx;
+
+        if (element == NULL || m->combine == NULL) {
+                return m->element;
+        }
+        return m->combine(key, element, m->element, m->ctx);
+}
+
+static
+int merge_visit(const char* key, size_t len, void* element, void* ctx) {
+        struct merge* m = ctx;
+        void* result;
+
+        m->element = element;
+        if (update(m->dst, key, len, merge_update, m, &result) == -1) {
+                m->failed = true;
+                return 1;
+        }
+        return 0;
+}
+
+int hash_merge(HashTable* dst, HashTable* src, HashMerge combine,
+               void* ctx) {
+        struct merge m = {dst, combine, ctx, NULL, false};
+
+        // Le due tabelle devono possedere gli elementi allo stesso modo,
+        // e la destinazione non può essere in sola lettura
+        if (dst == NULL || src == NULL || dst == src ||
+            dst->image != NULL || dst->ownership != src->ownership ||
+            dst->element_size != src->element_size) {
+                errno = EINVAL;
+                perror("Errore tabelle non compatibili");
+                return -1;
+        }
+
+        hash_for_each_range(src, 0, 1, merge_visit, &m);
+        return m.failed ? -1 : 0;
+}
+
+/*
+ * Fusione ad albero: al passo step la tabella i riceve la tabella
+ * i + step, per ogni i multiplo di 2 * step. Le coppie di un passo
+ * coinvolgono tabelle distinte e vengono fuse in parallelo, ogni worker
+ * prendendone una ogni n_threads.
+ */
+struct merge_tree {
+        HashTable** tables;
+        size_t n;
+        size_t step;
+        size_t n_threads;
+        HashMerge combine;
+        void* ctx;
+        Boolean failed;
+};
+
+static
+void* merge_pairs(void* arg) {
+        struct worker* w = arg;
+        struct merge_tree* t = w->job;
+        size_t i;
+
+        for (i = w->id * 2 * t->step; i + t->step < t->n;
+             i += t->n_threads * 2 * t->step) {
+                if (hash_merge(t->tables[i], t->tables[i + t->step],
+                               t->combine, t->ctx) != 0) {
+                        __atomic_store_n(&t->failed, true, __ATOMIC_RELAXED);
+                }
+        }
+        return NULL;
+}
+
+int hash_merge_all(HashTable** tables, size_t n, HashMerge combine,
+                   void* ctx, size_t n_threads) {
+        struct merge_tree t = {tables, n, 1, 1, combine, ctx, false};
+        size_t pairs;
+
+        for (t.step = 1; t.step < n && !t.failed; t.step *= 2) {
+                pairs = (n - t.step + 2 * t.step - 1) / (2 * t.step);
+                t.n_threads = n_threads < pairs ? n_threads : pairs;
+                if (t.n_threads < 1) {
+                        t.n_threads = 1;
+                }
+                run_workers(&t, t.n_threads, merge_pairs);
+        }
+        return t.failed ? -1 : 0;
+}
+
+/*
+ * Dimensione nell'immagine di un blocco di len byte, arrotondata così che
+ * ogni chiave e ogni elemento inizi allineato come nell'arena.
+ */
+static inline
+size_t image_chunk(size_t len) {
+        return (len + IMAGE_ALIGN - 1) & ~((size_t) IMAGE_ALIGN - 1);
+}
+
+static inline
+size_t image_element_size(HashTable* ht, void* element) {
+        if (ht->ownership == HASH_OWN_STRING) {
+                return strlen(element) + 1;
+        }
+        return ht->element_size;
+}
+
+/*
+ * Raccoglie in list i nodi occupati dello shard, di entrambi gli array
+ * durante un ridimensionamento incrementale, e ne restituisce il numero.
+ * Va chiamata con la read lock dello shard acquisita.
+ */
+static
+size_t collect_nodes(HashShard* shard, Node** list) {
+        NodeArray* arrays[2];
+        size_t n = 0;
+        size_t a, i;
+
+        arrays[0] = shard->table;
+        arrays[1] = shard->old;
+        for (a = 0; a < 2 && arrays[a] != NULL; a++) {
+                for (i = 0; i < arrays[a]->size; i++) {
+                        if (arrays[a]->node[i].key.word[0] != 0) {
+                                list[n++] = &arrays[a]->node[i];
+                        }
+                }
+        }
+        return n;
+}
+
+/*
+ * Sceglie i piloti dei buckets gruppi di chiavi, con i digest in digests,
+ * così che le n chiavi occupino n celle distinte. I gruppi vengono
+ * sistemati dal più numeroso, quando le celle libere sono molte; per
+ * ognuno vengono provati i piloti a partire da 0. Restituisce false se due
+ * chiavi hanno lo stesso digest, e non possono quindi essere separate, o
+ * se l'allocazione fallisce.
+ */
+static
+Boolean perfect_build(const size_t* digests, size_t n,
+                      uint32_t* pilots, size_t buckets) {
+        size_t* start;
+        size_t* order;
+        size_t* by_size;
+        size_t* count;
+        size_t* cells;
+        uint64_t* taken;
+        size_t max_size = 0;
+        size_t i, j, b, k, size, pos;
+        uint64_t pilot;
+        Boolean ok = true;
+
+        start = calloc(buckets + 1, sizeof(size_t));
+        order = malloc(n * sizeof(size_t));
+        by_size = malloc(buckets * sizeof(size_t));
+        taken = calloc((n + 63) / 64, sizeof(uint64_t));
+        if (start == NULL || order == NULL || by_size == NULL ||
+            taken == NULL) {
+                free(start);
+                free(order);
+                free(by_size);
+                free(taken);
+                return false;
+        }
+
+        // Raggruppo le chiavi per gruppo come nel caricamento in blocco:
+        // alla fine le chiavi del gruppo b sono order[start[b]..start[b+1])
+        for (i = 0; i < n; i++) {
+                start[fast_range(digests[i], buckets) + 1]++;
+        }
+        for (b = 1; b <= buckets; b++) {
+                start[b] += start[b - 1];
+        }
+        for (i = n; i > 0; i--) {
+                b = fast_range(digests[i - 1], buckets);
+                order[--start[b + 1]] = i - 1;
+        }
+        memmove(start, start + 1, buckets * sizeof(size_t));
+        start[buckets] = n;
+        for (b = 0; b < buckets; b++) {
+                if (start[b + 1] - start[b] > max_size) {
+                        max_size = start[b + 1] - start[b];
+                }
+        }
+
+        // Ordino i gruppi per numero di chiavi decrescente
+        count = calloc(max_size + 2, sizeof(size_t));
+        cells = malloc((max_size + 1) * sizeof(size_t));
+        if (count == NULL || cells == NULL) {
+                ok = false;
+        }
+        for (b = 0; b < buckets && ok; b++) {
+                count[max_size - (start[b + 1] - start[b]) + 1]++;
+        }
+        for (k = 1; k <= max_size + 1 && ok; k++) {
+                count[k] += count[k - 1];
+        }
+        for (b = 0; b < buckets && ok; b++) {
+                by_size[count[max_size - (start[b + 1] - start[b])]++] = b;
+        }
+
+        for (i = 0; i < buckets && ok; i++) {
+                b = by_size[i];
+                size = start[b + 1] - start[b];
+                pilots[b] = 0;
+                if (size == 0) {
+                        break;
+                }
+
+                for (j = 0; j < size && ok; j++) {
+                        for (k = 0; k < j; k++) {
+                                if (digests[order[start[b] + j]] ==
+                                    digests[order[start[b] + k]]) {
+                                        ok = false;
+                                }
+                        }
+                }
+
+                // Provo i piloti finché le chiavi del gruppo non cadono
+                // in celle libere e distinte
+                for (pilot = 0; pilot <= UINT32_MAX && ok; pilot++) {
+                        for (j = 0; j < size; j++) {
+                                pos = perfect_cell(digests[order[start[b] + j]],
+                                                   pilot, n);
+                                if (taken[pos / 64] & (1UL << (pos % 64))) {
+                                        break;
+                                }
+                                for (k = 0; k < j && cells[k] != pos; k++) {
+                                }
+                                if (k < j) {
+                                        break;
+                                }
+                                cells[j] = pos;
+                        }
+                        if (j == size) {
+                                break;
+                        }
+                }
+                if (pilot > UINT32_MAX) {
+                        ok = false;
+                }
+                for (j = 0; j < size && ok; j++) {
+                        taken[cells[j] / 64] |= 1UL << (cells[j] % 64);
+                }
+                pilots[b] = pilot;
+        }
+
+        free(start);
+        free(order);
+        free(by_size);
+        free(count);
+        free(cells);
+        free(taken);
+        return ok;
+}
+
+/*
+ * Costruisce in memoria l'immagine della tabella, tenendo le read lock di
+ * tutti gli shard così che sia una fotografia coerente: un primo passaggio
+ * calcola la posizione di ogni parte, il secondo colloca i nodi nelle
+ * celle (con il probing lineare, nello stesso numero di celle dell'array
+ * corrente, oppure con la funzione di hash perfetta) e copia chiavi ed
+ * elementi. I byte di riempimento restano a zero, per cui le chiavi
+ * ricevono anche il terminatore. Restituisce NULL se la tabella non può
+ * essere rappresentata o l'allocazione fallisce.
+ */
+static
+char* image_build(HashTable* ht, int layout, size_t* image_size) {
+        ImageHeader* header;
+        ImageShard* dir;
+        ImageNode* cells;
+        Node** list = NULL;
+        size_t* digests = NULL;
+        char* base = NULL;
+        size_t offset, heap, cursor, function;
+        size_t max_elements = 0;
+        size_t s, i, n, pos, len;
+        Boolean ok = true;
+
+        for (function = 0; function < IMAGE_FUNCTIONS &&
+                           image_functions[function] != ht->hash_function;
+             function++) {
+        }
+        if (function == IMAGE_FUNCTIONS || ht->image != NULL ||
+            ht->ownership == HASH_OWN_BORROWED) {
+                errno = EINVAL;
+                return NULL;
+        }
+
+        for (s = 0; s < ht->num_shards; s++) {
+                rdlock(&ht->shard[s].lock);
+                if (ht->shard[s].num_elements > max_elements) {
+                        max_elements = ht->shard[s].num_elements;
+                }
+        }
+
+        // Calcolo la posizione della directory, delle celle e dei piloti
+        // di ogni shard e la dimensione dei blocchi di chiavi ed elementi
+        dir = calloc(ht->num_shards, sizeof(ImageShard));
+        list = malloc((max_elements + 1) * sizeof(Node*));
+        digests = malloc((max_elements + 1) * sizeof(size_t));
+        if (dir == NULL || list == NULL || digests == NULL) {
+                ok = false;
+        }
+        offset = sizeof(ImageHeader) + ht->num_shards * sizeof(ImageShard);
+        heap = 0;
+        for (s = 0; s < ht->num_shards && ok; s++) {
+                n = collect_nodes(&ht->shard[s], list);
+                dir[s].num_elements = n;
+                dir[s].size = layout == IMAGE_PERFECT ?
+                              n : ht->shard[s].table->size;
+                dir[s].nodes = offset;
+                offset += dir[s].size * sizeof(ImageNode);
+                if (layout == IMAGE_PERFECT) {
+                        dir[s].buckets = (n + PERFECT_BUCKET_KEYS - 1) /
+                                         PERFECT_BUCKET_KEYS;
+                        dir[s].pilots = offset;
+                        offset += (dir[s].buckets * sizeof(uint32_t) + 7) &
+                                  ~(size_t) 7;
+                }
+                for (i = 0; i < n; i++) {
+                        len = key_length(&list[i]->key);
+                        if (len > HASH_INLINE_KEY) {
+                                heap += image_chunk(len + 1);
+                        }
+                        heap += image_chunk(image_element_size(ht,
+                                                               list[i]->element));
+                }
+        }
+        offset = image_chunk(offset);
+
+        if (ok) {
+                base = calloc(1, offset + heap);
+                ok = base != NULL;
+        }
+
+        cursor = offset;
+        for (s = 0; s < ht->num_shards && ok; s++) {
+                n = collect_nodes(&ht->shard[s], list);
+                cells = (ImageNode*) (base + dir[s].nodes);
+
+                // I nodi conservano solo i DIGEST_BITS del digest, mentre
+                // le celle e la funzione di hash perfetta usano quello
+                // intero, che viene quindi ricalcolato
+                for (i = 0; i < n; i++) {
+                        digests[i] = hash_mix(ht->hash_function(
+                                        key_string(&list[i]->key),
+                                        key_length(&list[i]->key), ht->seed));
+                }
+                if (layout == IMAGE_PERFECT && n > 0) {
+                        ok = perfect_build(digests, n,
+                                           (uint32_t*) (base + dir[s].pilots),
+                                           dir[s].buckets);
+                }
+
+                for (i = 0; i < n && ok; i++) {
+                        if (layout == IMAGE_PERFECT) {
+                                pos = perfect_cell(digests[i],
+                                        ((uint32_t*) (base + dir[s].pilots))
+                                        [fast_range(digests[i],
+                                                    dir[s].buckets)],
+                                        dir[s].size);
+                        } else {
+                                pos = image_bucket(dir[s].size, digests[i]);
+                                while (cells[pos].key.word[0] != 0) {
+                                        pos = pos + 1 == dir[s].size ?
+                                              0 : pos + 1;
+                                }
+                        }
+
+                        // Le chiavi hanno già nel nodo la forma della cella,
+                        // a parte lo spostamento di quelle lunghe
+                        len = key_length(&list[i]->key);
+                        cells[pos].hash = digests[i];
+                        cells[pos].key = list[i]->key;
+                        if (len > HASH_INLINE_KEY) {
+                                cells[pos].key.word[0] = cursor << 1;
+                                memcpy(base + cursor,
+                                       key_pointer(&list[i]->key), len);
+                                cursor += image_chunk(len + 1);
+                        }
+
+                        len = image_element_size(ht, list[i]->element);
+                        cells[pos].element = cursor;
+                        memcpy(base + cursor, list[i]->element, len);
+                        cursor += image_chunk(len);
+                }
+        }
+
+        for (s = 0; s < ht->num_shards; s++) {
+                rwlunlock(&ht->shard[s].lock);
+        }
+
+        if (ok) {
+                header = (ImageHeader*) base;
+                memcpy(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+                header->version = IMAGE_VERSION;
+                header->byte_order = IMAGE_BYTE_ORDER;
+                header->size = offset + heap;
+                header->layout = layout;
+                header->num_shards = ht->num_shards;
+                header->seed = ht->seed;
+                header->hash_function = function;
+                header->ownership = ht->ownership;
+                header->element_size = ht->element_size;
+                for (s = 0; s < ht->num_shards; s++) {
+                        header->capacity += dir[s].size;
+                        header->num_elements += dir[s].num_elements;
+                }
+                memcpy(header + 1, dir, ht->num_shards * sizeof(ImageShard));
+                *image_size = header->size;
+        } else {
+                free(base);
+                base = NULL;
+        }
+
+        free(dir);
+        free(list);
+        free(digests);
+        return base;
+}
+
+/*
+ * Controlla che intestazione e directory descrivano un'immagine di questa
+ * versione, scritta con lo stesso ordine dei byte e contenuta nei size
+ * byte dati. Le celle non vengono visitate, così che l'apertura non
+ * dipenda dal numero di chiavi: gli spostamenti di chiavi ed elementi
+ * vengono controllati da image_get e dalle scansioni.
+ */
+static
+Boolean image_valid(const char* base, size_t size) {
+        const ImageHeader* header = (const ImageHeader*) base;
+        const ImageShard* dir = (const ImageShard*) (header + 1);
+        uint64_t capacity = 0;
+        uint64_t num_elements = 0;
+        Boolean perfect;
+        size_t s;
+
+        if (memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 ||
+            header->version != IMAGE_VERSION ||
+            header->byte_order != IMAGE_BYTE_ORDER ||
+            header->size != size ||
+            (header->layout != IMAGE_LINEAR &&
+             header->layout != IMAGE_PERFECT) ||
+            header->hash_function >= IMAGE_FUNCTIONS ||
+            (header->ownership != HASH_OWN_STRING &&
+             header->ownership != HASH_OWN_BINARY)) {
+                return false;
+        }
+        perfect = header->layout == IMAGE_PERFECT;
+
+        // Il numero di shard deve essere una potenza di due, come quelli
+        // scelti da create_hash_table
+        if (header->num_shards == 0 || header->num_shards > (1 << 16) ||
+            (header->num_shards & (header->num_shards - 1)) != 0 ||
+            header->num_shards > (size - sizeof(ImageHeader)) /
+                                 sizeof(ImageShard)) {
+                return false;
+        }
+
+        for (s = 0; s < header->num_shards; s++) {
+                if ((dir[s].size == 0 && !perfect) || dir[s].nodes > size ||
+                    dir[s].nodes % sizeof(uint64_t) != 0 ||
+                    dir[s].size > (size - dir[s].nodes) / sizeof(ImageNode)) {
+                        return false;
+                }
+
+                // Con la funzione di hash perfetta ogni cella è occupata
+                // e ogni gruppo di chiavi ha il suo pilota
+                if (perfect &&
+                    (dir[s].size != dir[s].num_elements ||
+                     (dir[s].size > 0 && dir[s].buckets == 0) ||
+                     dir[s].pilots > size ||
+                     dir[s].pilots % sizeof(uint32_t) != 0 ||
+                     dir[s].buckets > (size - dir[s].pilots) /
+                                      sizeof(uint32_t))) {
+                        return false;
+                }
+                capacity += dir[s].size;
+                num_elements += dir[s].num_elements;
+        }
+        return capacity == header->capacity &&
+               num_elements == header->num_elements;
+}
+
+/*
+ * Restituisce una tabella in sola lettura servita dall'immagine in base:
+ * ha shard vuoti, usati solo per scegliere lo shard di una chiave, con
+ * seme e funzione di hash dell'immagine.
+ */
+static
+HashTable* image_table(const char* base, size_t size, Boolean mapped) {
+        const ImageHeader* header = (const ImageHeader*) base;
+        struct hash_image* image;
+        HashTable* ht;
+
+        ht = create_hash_table(header->num_shards, header->num_shards);
+        image = malloc(sizeof(struct hash_image));
+        if (ht == NULL || image == NULL) {
+                if (ht != NULL) {
+                        destroy_hash_table(ht);
+                }
+                free(image);
+                return NULL;
+        }
+
+        image->base = base;
+        image->size = size;
+        image->mapped = mapped;
+        image->perfect = header->layout == IMAGE_PERFECT;
+        image->header = header;
+        image->shard = (const ImageShard*) (header + 1);
+        ht->hash_function = image_functions[header->hash_function];
+        ht->seed = header->seed;
+        ht->ownership = header->ownership;
+        ht->element_size = header->element_size;
+        ht->image = image;
+        return ht;
+}
+
+/*
+ * L'immagine viene costruita in memoria, così che le lock siano tenute
+ * solo per la copia e non durante la scrittura, che avviene con un nome
+ * temporaneo rinominato solo se completo. Una tabella congelata o aperta
+ * da un'immagine viene scritta così com'è.
+ */
+/*
+ * Scrive size byte nel file aperto fd, ripetendo le scritture parziali.
+ * Restituisce false se una scrittura fallisce.
+ */
+static
+Boolean write_all(int fd, const char* data, size_t size) {
+        ssize_t written;
+
+        while (size > 0) {
+                written = write(fd, data, size);
+                if (written < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        return false;
+                }
+                data += written;
+                size -= written;
+        }
+        return true;
+}
+
+int hash_save(HashTable* ht, const char* path) {
+        char* tmp_path;
+        char* base;
+        size_t size;
+        Boolean ok;
+        int fd;
+
+        if (ht->image != NULL) {
+                base = (char*) ht->image->base;
+                size = ht->image->size;
+        } else {
+                base = image_build(ht, IMAGE_LINEAR, &size);
+                if (base == NULL) {
+                        perror("Tabella non salvabile");
+                        return -1;
+                }
+        }
+
+        tmp_path = malloc(strlen(path) + sizeof(".XXXXXX"));
+        if (tmp_path == NULL) {
+                if (ht->image == NULL) {
+                        free(base);
+                }
+                perror("Errore allocazione dell'immagine");
+                return -1;
+        }
+        sprintf(tmp_path, "%s.XXXXXX", path);
+
+        // Il file temporaneo ha un nome unico accanto a path, così che due
+        // salvataggi concorrenti non si sovrascrivano, e viene portato su
+        // disco prima della rename: dopo un crash path contiene l'immagine
+        // vecchia o quella nuova completa. mkstemp lo crea leggibile solo
+        // dal proprietario, mentre un'immagine è fatta per essere mappata
+        // anche da altri processi
+        fd = mkstemp(tmp_path);
+        ok = fd != -1 &&
+             fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == 0 &&
+             write_all(fd, base, size) &&
+             fsync(fd) == 0;
+        if (fd != -1 && close(fd) != 0) {
+                ok = false;
+        }
+        if (ok && rename(tmp_path, path) != 0) {
+                ok = false;
+        }
+        if (!ok) {
+                perror("Errore scrittura dell'immagine");
+                if (fd != -1) {
+                        unlink(tmp_path);
+                }
+        }
+
+        if (ht->image == NULL) {
+                free(base);
+        }
+        free(tmp_path);
+        return ok ? 0 : -1;
+}
+
+HashTable* hash_freeze(HashTable* ht) {
+        HashTable* frozen;
+        char* base;
+        size_t size;
+
+        base = image_build(ht, IMAGE_PERFECT, &size);
+        if (base == NULL) {
+                perror("Tabella non congelabile");
+                return NULL;
+        }
+
+        frozen = image_table(base, size, false);
+        if (frozen == NULL) {
+                free(base);
+                perror("Errore allocazione della tabella congelata");
+        }
+        return frozen;
+}
+
+HashTable* hash_open_mmap(const char* path) {
+        HashTable* ht;
+        struct stat st;
+        void* base;
+        int fd;
+
+        fd = open(path, O_RDONLY);
+        if (fd == -1) {
+                perror("Errore apertura dell'immagine");
+                return NULL;
+        }
+        if (fstat(fd, &st) != 0) {
+                close(fd);
+                perror("Errore apertura dell'immagine");
+                return NULL;
+        }
+        if ((size_t) st.st_size < sizeof(ImageHeader)) {
+                close(fd);
+                errno = EINVAL;
+                perror("Immagine non valida");
+                return NULL;
+        }
+
+        // La mappatura resta valida anche dopo la chiusura del file
+        base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+                perror("Errore mappatura dell'immagine");
+                return NULL;
+        }
+        if (!image_valid(base, st.st_size)) {
+                munmap(base, st.st_size);
+                errno = EINVAL;
+                perror("Immagine non valida");
+                return NULL;
+        }
+
+        ht = image_table(base, st.st_size, true);
+        if (ht == NULL) {
+                munmap(base, st.st_size);
+                perror("Errore allocazione dell'immagine");
+        }
+        return ht;
+}
+
+/*
+ * Imposta la densità d'espansione di tutti gli shard. hash_set_engine la
+ * usa per il valore predefinito del motore, che non prevale su quello
+ * scelto dall'utente.
+ */
+static
+void set_high_density(struct hash_table* ht, int fill_factor) {
+        size_t s;
+
+        for (s = 0; s < ht->num_shards; s++) {
+                wrlock(&ht->shard[s].lock);
+                ht->shard[s].high_density = fill_factor;
+                rwlunlock(&ht->shard[s].lock);
+        }
+}
+
+void hash_set_resize_high_density(struct hash_table* ht, int fill_factor) {
+        if (fill_factor < 1 || fill_factor > 99) {
+                return;
+        }
+
+        if (fill_factor + fill_factor < fill_factor) {
+                return;
+        }
+
+        set_high_density(ht, fill_factor);
+        ht->density_set = true;
+}
+
+void hash_set_resize_low_density(struct hash_table* ht, int fill_factor) {
+        size_t s;
+
+        if (fill_factor < 1 || fill_factor > 99) {
+                return;
+        }
+
+        if (fill_factor + fill_factor < fill_factor) {
+                return;
+        }
+
+        for (s = 0; s < ht->num_shards; s++) {
+                wrlock(&ht->shard[s].lock);
+                ht->shard[s].low_density = fill_factor;
+                rwlunlock(&ht->shard[s].lock);
+        }
+}
+
+void hash_set_tombstone_density(struct hash_table* ht, int fill_factor) {
+        size_t s;
+
+        if (fill_factor < 1 || fill_factor > 100) {
+                return;
+        }
+
+        for (s = 0; s < ht->num_shards; s++) {
+                wrlock(&ht->shard[s].lock);
+                ht->shard[s].tombstone_density = fill_factor;
+                rwlunlock(&ht->shard[s].lock);
+        }
+}
+
+/*
+ * Completa l'eventuale ridimensionamento incrementale in corso e
+ * ricostruisce subito, senza migrazione incrementale, gli shard che
+ * contengono TOMBSTONE.
+ */
+int hash_compact(struct hash_table* ht) {
+        HashShard* shard;
+        Boolean incremental;
+        int retr = 0;
+        size_t s;
+
+        for (s = 0; s < ht->num_shards; s++) {
+                shard = &ht->shard[s];
+                wrlock(&shard->lock);
+                if (shard->old != NULL) {
+                        migrate(shard, shard->old->size);
+                }
+                if (shard->table->tombstones > 0) {
+                        incremental = shard->incremental;
+                        shard->incremental = false;
+                        if (!hash_compact_shard(shard)) {
+                                retr = -1;
+                        }
+                        shard->incremental = incremental;
+                }
+                rwlunlock(&shard->lock);
+        }
+
+        return retr;
+}
+
+/*
+ * Sostituisce gli array di una tabella vuota con array del motore e della
+ * politica indicati. Restituisce 0 in caso di successo, -1 se la tabella
+ * non è vuota o in caso di errore.
+ */
+static
+int replace_arrays(HashTable* ht, Boolean swiss, Boolean robin_hood,
+                   Boolean power_of_two) {
+        HashShard* shard;
+        NodeArray** tables;
+        size_t size;
+        int retr = 0;
+        size_t s;
+
+        tables = malloc(ht->num_shards * sizeof(NodeArray*));
+        if (tables == NULL) {
+                return -1;
+        }
+
+        // Acquisisco i lock di tutti gli shard, così che nessuno possa
+        // inserire mentre controllo che la tabella sia vuota
+        for (s = 0; s < ht->num_shards; s++) {
+                wrlock(&ht->shard[s].lock);
+                if (ht->shard[s].num_elements > 0 || ht->shard[s].old != NULL ||
+                    ht->image != NULL) {
+                        retr = -1;
+                }
+        }
+
+        // Preparo tutti i nuovi array prima di sostituirli, così che in
+        // caso di errore la tabella resti invariata
+        for (s = 0; s < ht->num_shards && retr == 0; s++) {
+                size = ht->shard[s].table->size;
+                while (power_of_two && (size & (size - 1)) != 0) {
+                        // Azzero il bit meno significativo finché non
+                        // resta solo il più alto, poi lo raddoppio
+                        size &= size - 1;
+                        if ((size & (size - 1)) == 0) {
+                                size <<= 1;
+                        }
+                }
+                tables[s] = new_node_array(size, swiss, robin_hood);
+                if (tables[s] == NULL) {
+                        while (s > 0) {
+                                free(tables[--s]);
+                        }
+                        retr = -1;
+                }
+        }
+
+        for (s = 0; s < ht->num_shards; s++) {
+                shard = &ht->shard[s];
+                if (retr == 0) {
+                        // Pubblico il nuovo array prima di ritirare il
+                        // vecchio, che resta valido per i lettori
+                        tables[s] = exchange_table(shard, tables[s]);
+                        retire(shard, tables[s], 0);
+                }
+                rwlunlock(&shard->lock);
+        }
+
+        free(tables);
+        return retr;
+}
+
+int hash_set_engine(struct hash_table* ht, int engine) {
+        NodeArray* table = ht->shard[0].table;
+        Boolean swiss = engine == HASH_ENGINE_SWISS;
+
+        if (engine != HASH_ENGINE_LINEAR && !swiss) {
+                return -1;
+        }
+
+        // La politica Robin Hood resta attiva con il motore lineare, come
+        // in hash_set_power_of_two; il motore swiss non la prevede
+        if (replace_arrays(ht, swiss, !swiss && table->robin_hood,
+                           false) != 0) {
+                return -1;
+        }
+
+        // La densità predefinita del motore vale solo se l'utente non ne
+        // ha scelta una
+        if (!ht->density_set) {
+                set_high_density(ht, engine == HASH_ENGINE_SWISS ?
+                                     SWISS_MAX_LOAD : TABLE_MAX_LOAD);
+        }
+        return 0;
+}
+
+int hash_set_robin_hood(struct hash_table* ht, int enable) {
+        // La politica Robin Hood è disponibile solo con il motore lineare
+        if (ht->shard[0].table->ctrl != NULL) {
+                return -1;
+        }
+
+        return replace_arrays(ht, false, enable != 0, false);
+}
+
+int hash_set_power_of_two(struct hash_table* ht) {
+        NodeArray* table = ht->shard[0].table;
+
+        return replace_arrays(ht, table->ctrl != NULL, table->robin_hood, true);
+}
+
+/*
+ * Acquisisce i lock di tutti gli shard, così che nessuno possa inserire
+ * mentre viene cambiata un'impostazione della tabella, e restituisce -1
+ * se la tabella non è vuota. I lock vanno rilasciati con unlock_all.
+ */
+static
+int lock_empty(HashTable* ht) {
+        int retr = 0;
+        size_t s;
+
+        for (s = 0; s < ht->num_shards; s++) {
+                wrlock(&ht->shard[s].lock);
+                if (ht->shard[s].num_elements > 0 || ht->shard[s].old != NULL ||
+                    ht->image != NULL) {
+                        retr = -1;
+                }
+        }
+        return retr;
+}
+
+static
+void unlock_all(HashTable* ht) {
+        size_t s;
+
+        for (s = 0; s < ht->num_shards; s++) {
+                rwlunlock(&ht->shard[s].lock);
+        }
+}
+
+/*
+ * Cambia la funzione di hash di una tabella vuota: i digest salvati nei
+ * nodi e la scelta degli shard dipendono da essa, per cui non può essere
+ * cambiata dopo il primo inserimento.
+ */
+int hash_set_hash_function(struct hash_table* ht, HashFunction function) {
+        int retr;
+
+        retr = lock_empty(ht);
+        if (retr == 0) {
+                ht->hash_function =
+                        function != NULL ? function : DEFAULT_HASH_FUNCTION;
+        }
+        unlock_all(ht);
+
+        return retr;
+}
+
+/*
+ * Cambia la modalità di possesso di una tabella vuota: i nodi presenti
+ * verrebbero altrimenti liberati con la modalità sbagliata.
+ */
+int hash_set_ownership(struct hash_table* ht, int ownership,
+                       size_t element_size) {
+        int retr;
+
+        if (ownership != HASH_OWN_STRING && ownership != HASH_OWN_BORROWED &&
+            (ownership != HASH_OWN_BINARY || element_size == 0)) {
+                return -1;
+        }
+
+        retr = lock_empty(ht);
+        if (retr == 0) {
+                ht->ownership = ownership;
+                ht->element_size = element_size;
+        }
+        unlock_all(ht);
+
+        return retr;
+}
+
+/*
+ * Abilita o disabilita l'arena di ogni shard di una tabella vuota. Una
+ * volta creata l'arena resta allocata fino alla distruzione della tabella,
+ * dato che i blocchi nel limbo possono ancora tornarvi.
+ */
+int hash_set_arena(struct hash_table* ht, int enable) {
+        HashShard* shard;
+        int retr;
+        size_t s;
+
+        retr = lock_empty(ht);
+        for (s = 0; s < ht->num_shards && retr == 0; s++) {
+                shard = &ht->shard[s];
+                if (shard->arena == NULL && enable) {
+                        shard->arena = calloc(1, sizeof(HashArena));
+                        if (shard->arena == NULL) {
+                                perror("Errore durante l'allocazione "
+                                       "dell'arena");
+                                retr = -1;
+                                break;
+                        }
+                }
+                if (shard->arena != NULL) {
+                        shard->arena->enabled = enable != 0;
+                }
+        }
+        unlock_all(ht);
+
+        return retr;
+}
+
+void hash_set_resize_threads(struct hash_table* ht, size_t n_threads) {
+        size_t s;
+
+        for (s = 0; s < ht->num_shards; s++) {
+                wrlock(&ht->shard[s].lock);
+                ht->shard[s].resize_threads = n_threads > 0 ? n_threads : 1;
+                rwlunlock(&ht->shard[s].lock);
+        }
+}
+
+void hash_set_thread_local(struct hash_table* ht, int enable) {
+        size_t s;
+
+        for (s = 0; s < ht->num_shards; s++) {
+                wrlock(&ht->shard[s].lock);
+                ht->shard[s].local = enable != 0;
+                rwlunlock(&ht->shard[s].lock);
+        }
+}
+
+void hash_set_incremental_resize(struct hash_table* ht, int enable) {
+        HashShard* shard;
+        size_t s;
+
+        for (s = 0; s < ht->num_shards; s++) {
+                shard = &ht->shard[s];
+                wrlock(&shard->lock);
+                shard->incremental = enable != 0;
+
+                // Disabilitando la modalità completo subito le migrazioni
+                // in corso
+                if (!shard->incremental && shard->old != NULL) {
+                        migrate(shard, shard->old->size);
+                }
+                rwlunlock(&shard->lock);
+        }
+}
+
+/*
+ * Libera chiavi ed elementi dei nodi non nulli di un array, se di
+ * proprietà della tabella, e l'array stesso. Con l'arena abilitata i
+ * nodi non vengono visitati: le slab sono liberate tutte insieme.
+ */
+static
+void free_nodes(HashTable* ht, HashShard* shard, NodeArray* table) {
+        Boolean owned;
         size_t i;
+
+        if (table == NULL) {
+                return;
+        }
+
+        owned = ht->ownership != HASH_OWN_BORROWED &&
+                (shard->arena == NULL || !shard->arena->enabled);
+        for (i = 0; i < table->size && owned; i++) {
+                if (table->node[i].key.word[0] != 0) {
+                        if (ht->ownership == HASH_OWN_STRING) {
+                                free(key_pointer(&table->node[i].key));
+                        }
+                        free(table->node[i].element);
+                }
+        }
+        free(table);
+}
+
+/*
+ * La distruzione presuppone che nessun thread stia ancora usando la
+ * HashTable, per cui libera subito anche la memoria nel limbo.
+ */
+void destroy_hash_table(HashTable* ht) {
+        HashShard* shard;
+
+        for (size_t s = 0; s < ht->num_shards; s++) {
+                shard = &ht->shard[s];
+                free_nodes(ht, shard, shard->table);
+                free_nodes(ht, shard, shard->old);
+                for (size_t i = 0; i < shard->limbo_len; i++) {
+                        if (shard->limbo[i].size == 0) {
+                                free(shard->limbo[i].ptr);
+                        }
+                }
+                pthread_rwlock_destroy(&shard->lock);
+                free(shard->limbo);
+                arena_destroy(shard->arena);
+        }
+
+        if (ht->image != NULL && ht->image->mapped) {
+                munmap((void*) ht->image->base, ht->image->size);
+        } else if (ht->image != NULL) {
+                free((void*) ht->image->base);
+        }
+        free(ht->image);
+        free(ht->shard);
+        free(ht);
+}
+
+/*
+ * Stampa a schermo il contenuto della HashTable formattato
+ */
+void pretty_print(HashTable* ht) {
+        NodeArray* arrays[2];
+        NodeArray* table;
+        size_t i, s, a;
         
         printf("\n\n");
-        printf("    index\t\t key\t\t element\t \n\n");
-        for (i = 0; i < ht->size; i++) {
-                if (ht->node[i].key != NULL) {
-                        printf("    %-10lu\t\t %-12s\t\t %8s\t \n\n",
-                               i,
-                               ht->node[i].key,
-                               (char*) ht->node[i].element);
+        printf("    shard\t index\t\t key\t\t element\t \n\n");
+        for (s = 0; s < ht->num_shards; s++) {
+                rdlock(&ht->shard[s].lock);
+                arrays[0] = ht->shard[s].table;
+                arrays[1] = ht->shard[s].old;
+                for (a = 0; a < 2 && arrays[a] != NULL; a++) {
+                        table = arrays[a];
+                        for (i = 0; i < table->size; i++) {
+                                if (table->node[i].key.word[0] == 0) {
+                                        continue;
+                                }
+                                printf("    %-5lu\t %-10lu\t\t %-12.*s\t\t "
+                                       "%8s\t \n\n",
+                                       s,
+                                       i,
+                                       (int) key_length(&table->node[i].key),
+                                       key_string(&table->node[i].key),
+                                       (char*) table->node[i].element);
+                        }
                 }
+                rwlunlock(&ht->shard[s].lock);
         }
         printf("\n\n");
 }
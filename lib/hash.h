@@ -4,56 +4,486 @@
 #include <stddef.h>
 #include <pthread.h>
 
+#define HASH_CACHE_LINE 64
+
+/* Key of a node
+ * keys of at most HASH_INLINE_KEY bytes are copied in the node itself,
+ * after a first byte equal to twice their length plus 1 and followed by
+ * a NUL terminator, so that comparing them touches no other memory.
+ * Longer keys are stored as a pointer shifted left by one bit in word[0]
+ * and their length in the low half of word[1]: the low bit of word[0]
+ * tells the two forms apart, and word[0] is 0 in unused nodes. In both
+ * forms the high half of word[1] holds the high 32 bits of the digest
+ * of the key, compared together with the key and reused when the table
+ * is resized. The tag byte must be the low byte of word[0], so the
+ * library builds only on little-endian targets */
+typedef union node_key {
+        size_t word[2];
+        char bytes[2 * sizeof(size_t)];
+} NodeKey;
+
+/* Longest key stored inline: 10 bytes on 64-bit targets, as the 16
+ * bytes of NodeKey also hold the tag byte, the NUL terminator and 4
+ * bytes of digest. Longer keys, including the 11-15 byte keys common in
+ * word counts and in the 8:16 default of test/bench.c, take the pointer
+ * form and a separate allocation, so a hit reads one more cache line.
+ * Compared with the previous 32 byte Node, which stored up to 14 bytes
+ * inline, 2M keys of 11-14 bytes looked up in random order take 388
+ * instead of 265 ns per hit (318 instead of 303 per miss) and use 112
+ * instead of 96 bytes per key, while keys of at most 10 bytes go from
+ * 266 to 198 ns per hit and from 96 to 80 bytes per key */
+#define HASH_INLINE_KEY (2 * sizeof(size_t) - 6)
+
+/* Longest key accepted, as its length must fit in half of word[1] */
+#define HASH_MAX_KEY 0xFFFFFFFFUL
+
 /* HashTable entries
- * contains a key which is used to index the hash table
- * and the element itself which is stored at the key */
+ * contains a key which is used to index the hash table,
+ * together with part of its digest, and the element
+ * itself which is stored at the key */
 typedef struct node {
-        char* key;
+        NodeKey key;
         void* element;
 } Node;
 
-/* HashTable structure
- * contains an array of Node
- * and size of the hashtable */
-typedef struct hash_table {
-        Node *node;
+/* Array of Node
+ * the size is kept together with the nodes so that a lock-free
+ * reader always sees an array and its own size; mask is size - 1
+ * when the size is a power of two, 0 otherwise. With the swiss
+ * engine ctrl holds one control byte per node (a 7 bit fragment of
+ * the digest, or empty/deleted) followed by a copy of the first
+ * bytes, so that a group of bytes can always be loaded at once.
+ * robin_hood is set when the nodes follow the Robin Hood policy, and
+ * tombstones counts the removed nodes not yet reused */
+typedef struct node_array {
+        size_t size;
+        size_t mask;
+        unsigned char* ctrl;
+        int robin_hood;
+        size_t tombstones;
+        Node node[];
+} NodeArray;
+
+/* Memory removed from a shard
+ * it is freed only when no reader can still reference it, that is
+ * two epochs after the one in which it was retired. size is the size
+ * of the block in the shard's arena, 0 if it was allocated by malloc */
+typedef struct hash_retired {
+        void* ptr;
+        unsigned long epoch;
         size_t size;
+} HashRetired;
+
+#define HASH_ARENA_CLASSES 16
+
+/* Arena of a shard
+ * keys and elements are carved out of a list of slabs, each one twice as
+ * large as the previous; freed blocks are recycled through one free list
+ * per size class (multiples of 16 bytes up to HASH_ARENA_CLASSES * 16).
+ * Larger blocks are allocated one by one and linked in the large list */
+typedef struct hash_arena {
+        char* slab;
+        void* large;
+        size_t used;
+        size_t slab_size;
+        void* free_list[HASH_ARENA_CLASSES];
+        int enabled;
+} HashArena;
+
+/* HashTable shard
+ * contains an array of Node and its own resize thresholds and lock.
+ * seq is odd while a writer is modifying the nodes, so that readers
+ * which do not take the lock can detect it and retry.
+ * During an incremental resize old is the array being drained and
+ * migrated the index of its next node to move into table.
+ * resize_threads is the number of threads sharing a full rehash.
+ * local is set when the table is used by a single thread, which then
+ * takes neither the lock for writes nor an epoch for reads.
+ * expansions and shrinks count the resizes of the shard, compactions its
+ * rebuilds at the same size to drop tombstones.
+ * Each shard is aligned to a cache line so that shards do not share one */
+typedef struct hash_shard {
+        _Alignas(HASH_CACHE_LINE) NodeArray *table;
+        NodeArray *old;
+        size_t migrated;
+        int incremental;
+        size_t resize_threads;
+        int local;
         size_t num_elements;
+        size_t expansions;
+        size_t shrinks;
+        size_t compactions;
+        unsigned long seq;
         int high_density;
         int low_density;
+        int tombstone_density;
+        HashRetired* limbo;
+        size_t limbo_len;
+        size_t limbo_size;
+        HashArena* arena;
         pthread_rwlock_t lock;
+} HashShard;
+
+/* Cursor over a HashTable
+ * filled by hash_iter_begin; its fields are private */
+typedef struct hash_iter {
+        struct hash_table* ht;
+        size_t shard;
+        Node* entries;
+        size_t capacity;
+        size_t len;
+        size_t pos;
+        int started;
+} HashIter;
+
+#define HASH_STATS_PROBES 16
+
+/* Structural statistics of a HashTable, filled by hash_stats
+ * capacity is the number of cells (as hash_size), elements the number of
+ * keys and load_factor their ratio; tombstones counts removed nodes not
+ * yet reused. probe_histogram[i] counts the keys found i cells after
+ * their home cell, the last entry those found at least
+ * HASH_STATS_PROBES - 1 cells after it. longest_cluster is the longest
+ * run of non-empty cells, which bounds the probes of a missing key.
+ * expansions and shrinks count the resizes since the table was created,
+ * compactions the rebuilds at the same size that dropped tombstones */
+typedef struct hash_stats {
+        size_t capacity;
+        size_t elements;
+        size_t tombstones;
+        double load_factor;
+        size_t probe_histogram[HASH_STATS_PROBES];
+        double mean_probe;
+        size_t max_probe;
+        size_t longest_cluster;
+        size_t expansions;
+        size_t shrinks;
+        size_t compactions;
+} HashStats;
+
+#define HASH_TRACE_BUCKETS 32
+
+/* Histogram of a traced quantity
+ * count, sum and max of the values recorded; bucket[0] counts the zeros
+ * and bucket[i] the values from 2^(i-1) to 2^i - 1, the last bucket
+ * every larger value too */
+typedef struct hash_trace_histogram {
+        size_t count;
+        size_t sum;
+        size_t max;
+        size_t bucket[HASH_TRACE_BUCKETS];
+} HashTraceHistogram;
+
+/* Measures collected when the library is compiled with HASH_TRACE, summed
+ * over every thread and table of the process by hash_trace_snapshot:
+ * - lock_wait, lock_hold: nanoseconds spent waiting for and holding a
+ *   shard's write lock in inserts and removals (not thread-local tables)
+ * - probes: cells (groups with the swiss engine) examined after the home
+ *   one by each search of a node array
+ * - alloc: nanoseconds spent copying a key and element into the table
+ * - resize: nanoseconds each resize of a shard kept its lock */
+typedef struct hash_trace {
+        HashTraceHistogram lock_wait;
+        HashTraceHistogram lock_hold;
+        HashTraceHistogram probes;
+        HashTraceHistogram alloc;
+        HashTraceHistogram resize;
+} HashTrace;
+
+/* Hashing function
+ * returns the digest of the len bytes at key, starting from the
+ * given seed */
+typedef size_t (*HashFunction)(const char* key, size_t len, size_t seed);
+
+/* Image of a table mapped by hash_open_mmap; its fields are private */
+struct hash_image;
+
+/* HashTable structure
+ * contains an array of shards, each one holding a slice
+ * of the keys chosen by the high bits of their hash, the
+ * hashing function with the table's random seed and how the
+ * table owns keys and elements (see hash_set_ownership).
+ * image is the mapped file of a table opened with hash_open_mmap,
+ * NULL otherwise. density_set records a call to
+ * hash_set_resize_high_density, whose value the engine's default does
+ * not override */
+typedef struct hash_table {
+        HashShard *shard;
+        size_t num_shards;
+        unsigned int shard_bits;
+        HashFunction hash_function;
+        size_t seed;
+        int ownership;
+        size_t element_size;
+        struct hash_image* image;
+        int density_set;
 } HashTable;
 
 
-/* Create an empty hash table, with size cells. 
+/* Create an empty hash table, with size cells split among num_shards
+ * shards. num_shards is rounded up to a power of two; 0 or 1 give a
+ * table with a single lock.
  * Return a pointer to a structure with the table's information, of
  * NULL in case of failure (e.g. out of free memory) */
-HashTable* create_hash_table(size_t size);
+HashTable* create_hash_table(size_t size, size_t num_shards);
 
 /* Insert the given element, with the given key, to the given hash table. 
  * Return 1 on success, 0 if an element with
  * the same key is already found in the table, or -1 if the table is full */
 int hash_insert(HashTable* ht, char* key, void* element);
 
+/* Every function taking a NUL-terminated key has a _n variant taking the
+ * key as len bytes at key instead: it needs no terminator and may contain
+ * NUL bytes, so slices of a larger buffer can be used without copying.
+ * Keys are compared by length first and then with memcmp; a key given
+ * with strlen is the same key under both forms. Keys longer than
+ * HASH_MAX_KEY bytes are never found, and inserting one fails with -1 */
+int hash_insert_n(HashTable* ht, const void* key, size_t len,
+                  void* element);
+
+/* Update function
+ * receives the key and its current element, or NULL if the key is not
+ * in the table, and returns the element to store. Returning NULL or the
+ * current element leaves the table unchanged. It runs with the shard's
+ * write lock held and must not call the table. The key is the one given
+ * by the caller: with the _n variants it is not NUL-terminated */
+typedef void* (*HashUpdate)(char* key, void* element, void* ctx);
+
+/* Find or create the entry of the given key and store the element
+ * returned by fn, called with ctx, with a single probe and a single
+ * acquisition of the shard's lock, so that concurrent updates of the
+ * same key are never lost.
+ * Return 1 if a new key was inserted, 0 if the element was replaced or
+ * left unchanged, or -1 if the table is full */
+int hash_upsert(HashTable* ht, char* key, HashUpdate fn, void* ctx);
+int hash_upsert_n(HashTable* ht, const void* key, size_t len,
+                  HashUpdate fn, void* ctx);
+
+/* Return the element of the given key, inserting a copy of the given
+ * element first if the key is missing. Like every call returning an
+ * element it runs inside an epoch (see hash_epoch_enter). Return NULL
+ * on failure */
+void* hash_get_or_insert(HashTable* ht, char* key, void* element);
+void* hash_get_or_insert_n(HashTable* ht, const void* key, size_t len,
+                           void* element);
+
+/* Replace the element of the given key with desired only if its current
+ * element equals expected (compared as the table's ownership mode
+ * stores elements: strings, bytes or pointers); a NULL expected means
+ * that the key must be missing, in which case it is inserted.
+ * Return 1 if the element was stored, 0 if the comparison failed, or
+ * -1 on failure */
+int hash_compare_and_swap(HashTable* ht, char* key,
+                          void* expected, void* desired);
+int hash_compare_and_swap_n(HashTable* ht, const void* key, size_t len,
+                            void* expected, void* desired);
+
 /* Retrive the element, with the given key, to the given hash table.
+ * It takes no lock and can run while the table is being resized.
  * Return void pointer which should be cast to whatever the element
- * originally was or NULL in case of failure */
+ * originally was or NULL in case of failure. It runs inside an epoch
+ * (see hash_epoch_enter) */
 void* hash_get(HashTable* ht, char* key);
+void* hash_get_n(HashTable* ht, const void* key, size_t len);
 
 /* Remove the element with the given key from the hash table. 
  * Return a pointer to the removed element, or NULL
- * if the element was not found in the table. */
+ * if the element was not found in the table. It runs inside an epoch
+ * (see hash_epoch_enter) */
 void* hash_remove(HashTable* ht, char* key);
+void* hash_remove_n(HashTable* ht, const void* key, size_t len);
+
+/* Batched operations on the n keys in keys, with their lengths in lens as
+ * for the _n variants, or lens NULL for NUL-terminated keys. The digests
+ * of a block of keys are computed first and the home cell of each key is
+ * prefetched, so that the cache misses of different keys overlap; writes
+ * take the lock of each shard once for all the keys of the block that
+ * belong to it. Operations on the same key are applied in order.
+ * hash_get_batch stores in elements[i] the element of keys[i], or NULL,
+ * and returns the number of keys found; the elements stay valid as for
+ * hash_get. hash_insert_batch inserts elements[i] with keys[i], stores in
+ * results[i] (if results is not NULL) what hash_insert would return and
+ * returns the number of new keys. hash_remove_batch stores the removed
+ * elements in elements (if not NULL) and returns their number */
+size_t hash_get_batch(HashTable* ht, char** keys, size_t* lens, size_t n,
+                      void** elements);
+size_t hash_insert_batch(HashTable* ht, char** keys, size_t* lens, size_t n,
+                         void** elements, int* results);
+size_t hash_remove_batch(HashTable* ht, char** keys, size_t* lens, size_t n,
+                         void** elements);
+
+/* Resize every shard, once, so that n elements spread over the table fit
+ * under its expansion density (with a small margin for uneven shards).
+ * Shards already large enough are left as they are.
+ * Return 0 on success, -1 on failure (out of memory) */
+int hash_reserve(HashTable* ht, size_t n);
+
+/* Insert the n elements of elements with the keys of keys (with lengths
+ * in lens, or lens NULL for NUL-terminated keys), as n calls of
+ * hash_insert would. The digests are computed by n_threads threads, the
+ * keys are grouped by shard and each thread then fills one shard at a
+ * time: it takes the shard's lock once, resizes it once to its final
+ * size and inserts all of its keys. Threads therefore help only as long
+ * as the table has at least as many shards. NULL elements are skipped.
+ * Return 0 on success, -1 on failure (out of memory) */
+int hash_bulk_load(HashTable* ht, char** keys, size_t* lens,
+                   void** elements, size_t n, size_t n_threads);
 
-/* Return the number of elements found in the given hash table */
+/* Enter a read-side epoch. Elements returned by the table
+ * (hash_get, hash_get_or_insert, hash_remove and their _n and _batch
+ * variants) are not freed before the calling thread leaves the epoch with
+ * hash_epoch_exit. Each of those calls enters an epoch of its own for its
+ * duration, so the element is safe to read while the call runs; it stays
+ * valid after the call returns only if the caller was already inside an
+ * epoch, and may otherwise be freed at once by a concurrent writer.
+ * Calls can be nested */
+void hash_epoch_enter(void);
+
+/* Leave the epoch entered with hash_epoch_enter */
+void hash_epoch_exit(void);
+
+/* Start a scan of the whole table. The cursor copies the entries of one
+ * shard at a time under its read lock, so writers (including the scanning
+ * thread) may modify the table and resize it meanwhile: every key present
+ * for the whole scan is returned exactly once, keys inserted or removed
+ * meanwhile may or may not be. The calling thread stays in an epoch until
+ * hash_iter_end, so returned elements stay valid until then */
+void hash_iter_begin(HashTable* ht, HashIter* it);
+
+/* Store in key, len and element (len and element may be NULL) the next
+ * entry of the scan. key points to the table's copy of the key, or to the
+ * cursor for short keys, and is valid until the next call.
+ * Return 1 if an entry was stored, 0 at the end of the table, or -1 on
+ * failure (out of memory) */
+int hash_iter_next(HashIter* it, char** key, size_t* len, void** element);
+
+/* Release the cursor and leave its epoch */
+void hash_iter_end(HashIter* it);
+
+/* Visit function
+ * receives a key with its length and element; returning a value other
+ * than 0 stops the visit. It runs with the shard's read lock held and
+ * must not modify the table */
+typedef int (*HashVisit)(const char* key, size_t len, void* element,
+                         void* ctx);
+
+/* Call fn on the entries found in the part-th of nparts equal slot ranges
+ * of every shard, so that nparts threads, each with its own part, scan the
+ * table in parallel. The slot ranges of a shard are read under its read
+ * lock. If the table is not modified meanwhile every entry is visited by
+ * exactly one part; an entry moved by a concurrent resize may be missed
+ * or visited twice. Return the number of entries visited */
+size_t hash_for_each_range(HashTable* ht, size_t part, size_t nparts,
+                           HashVisit fn, void* ctx);
+
+/* Merge function
+ * receives a key found in both tables of hash_merge, with the element of
+ * the destination and that of the source, and returns the element to
+ * store in the destination (copied as by hash_upsert). Returning NULL or
+ * the destination's element leaves it unchanged. It runs with the write
+ * lock of the destination's shard and the read lock of the source's one
+ * held, and must not call either table */
+typedef void* (*HashMerge)(char* key, void* dst_element, void* src_element,
+                           void* ctx);
+
+/* Insert every entry of src into dst: keys missing from dst get src's
+ * element, keys in both get the element returned by combine, or src's one
+ * if combine is NULL. src is not modified. Both tables must own keys and
+ * elements in the same way, and dst must not be read-only.
+ * Return 0 on success, -1 on failure (incompatible tables, out of memory)
+ * in which case dst may hold part of src */
+int hash_merge(HashTable* dst, HashTable* src, HashMerge combine,
+               void* ctx);
+
+/* Merge the n tables into tables[0] as a tree: at each round table i
+ * receives table i + step, for every i multiple of 2 * step, and the pairs
+ * of a round are merged by up to n_threads threads. The other tables may
+ * be modified and must still be destroyed by the caller; combine may run
+ * on several threads at once. This is how partial results filled by one
+ * thread each, with hash_set_thread_local, are combined at the end.
+ * Return 0 on success, -1 if any merge failed */
+int hash_merge_all(HashTable** tables, size_t n, HashMerge combine,
+                   void* ctx, size_t n_threads);
+
+/* Fill out with the tracing measures accumulated since the process
+ * started; the difference of two snapshots covers the interval between
+ * them. Each thread records into its own counters, and this function only
+ * reads them, so it can run while the tables are in use. Without
+ * HASH_TRACE the library records nothing and costs nothing.
+ * Return 0, or -1 (with out zeroed) if the library was compiled without
+ * HASH_TRACE */
+int hash_trace_snapshot(HashTrace* out);
+
+/* Return the number of elements found in the given hash table. It reads
+ * one counter per shard, takes no lock and can run concurrently with
+ * writers */
 size_t hash_num_elements(HashTable* ht);
 
+/* Return the number of cells of the given hash table (all shards) */
+size_t hash_size(HashTable* ht);
+
+/* Fill out with the structural statistics of the table. Each shard is
+ * visited under its read lock, so the call costs a scan of all cells and
+ * can run concurrently with writers */
+void hash_stats(HashTable* ht, HashStats* out);
+
+/* Write to path an image of the table: for every shard its cells, with
+ * the digest of each key and the offsets of key and element, followed by
+ * the bytes of keys and elements. Offsets are relative to the start of
+ * the file, so the image can be mapped at any address. The image also
+ * records the seed, the hashing function and the ownership mode. It is
+ * copied in memory under the read lock of every shard, so it is a
+ * consistent snapshot, and then written to a uniquely named file beside
+ * path, flushed to disk and renamed over it: tables already mapping the
+ * previous image are not affected, concurrent saves do not mix their
+ * data, and after a crash path holds either the old or the complete new
+ * image. The file is readable by everyone and writable by its owner.
+ * Frozen and mapped tables are written as they are.
+ * Only tables using a built-in hashing function and owning their keys
+ * and elements (HASH_OWN_STRING or HASH_OWN_BINARY) can be saved.
+ * Return 0 on success, -1 on failure */
+int hash_save(HashTable* ht, const char* path);
+
+/* Map read-only an image written by hash_save and return a table serving
+ * hash_get, the batched lookups, scans and counts directly from it: the
+ * cost of opening does not depend on the number of keys, and pages are
+ * read from the file as lookups touch them. Lookups take no lock and no
+ * epoch; returned keys and elements point into the mapping, stay valid
+ * until destroy_hash_table and must not be modified. Writes, resizes and
+ * settings fail on such a table, and hash_stats reports only capacity,
+ * elements and load factor.
+ * Return NULL if the file cannot be mapped or is not a valid image */
+HashTable* hash_open_mmap(const char* path);
+
+/* Return an immutable copy of the table, read as a table opened with
+ * hash_open_mmap. Keys and elements are packed in a single block, and
+ * the keys of each shard are placed by a minimal perfect hash function
+ * (CHD/PTHash style: one 32 bit pilot per group of about 4 keys), so the
+ * copy has exactly one cell per key and a lookup reads one pilot, one
+ * cell and compares one key. The original table is left unchanged. The
+ * copy can be saved with hash_save and mapped again with hash_open_mmap.
+ * The same restrictions as hash_save apply.
+ * Return NULL on failure */
+HashTable* hash_freeze(HashTable* ht);
+
 /* Delete the given hash table, freeing any memory it currently uses
  * (but do NOT free any elements that might still be in it) */
 void destroy_hash_table(HashTable* ht);
 
-/* Hashing function */
-size_t hash_value(HashTable* ht, char* key);
+/* Hashing function, returns the full digest of the key computed by the
+ * default function with seed 0. Tables use their own random seed, mix
+ * the digest once more and derive the cell from it separately */
+size_t hash_value(char* key);
+size_t hash_value_n(const void* key, size_t len);
+
+/* Built-in hashing functions. hash_wyhash reads the key 8 bytes at a
+ * time and is the default; the others read one byte at a time and are
+ * kept for comparison. Only hash_wyhash mixes the seed well enough to
+ * make colliding keys hard to find without knowing it */
+size_t hash_wyhash(const char* key, size_t len, size_t seed);
+size_t hash_fnv1a(const char* key, size_t len, size_t seed);
+size_t hash_sdbm(const char* key, size_t len, size_t seed);
+size_t hash_djb2(const char* key, size_t len, size_t seed);
 
 /* Set the fill density of the table after which it will be expanded. 
    The fill factor is a number between 1 and 100. */
@@ -63,7 +493,100 @@ void hash_set_resize_high_density(struct hash_table* ht, int fill_factor);
    The fill factor is a number between 1 and 100.*/
 void hash_set_resize_low_density(struct hash_table* ht, int fill_factor);
 
+/* Set the density of tombstones (removed nodes, which lookups of missing
+   keys still probe) after which a shard is rebuilt at the same size.
+   The fill factor is a number between 1 and 100, by default 20. When
+   elements and tombstones leave less than 5% of a shard's nodes empty,
+   the shard is rebuilt if at least 5% of them are tombstones and
+   expanded by the next insertion otherwise. */
+void hash_set_tombstone_density(struct hash_table* ht, int fill_factor);
+
+/* Rebuild at the same size every shard containing tombstones, completing
+   any incremental resize first, so that probe lengths return to those of
+   a table without removals. It takes each shard's write lock in turn.
+   Return 0 on success, -1 on failure (out of memory) */
+int hash_compact(struct hash_table* ht);
+
+/* Select the probing engine of an empty table: HASH_ENGINE_LINEAR probes
+   one node at a time, HASH_ENGINE_SWISS scans a separate array of control
+   bytes a group at a time (SSE2/AVX2 when available) and raises the
+   expansion density to 87, unless hash_set_resize_high_density was called.
+   Robin Hood insertion stays enabled with the linear engine and is turned
+   off by the swiss one.
+   Return 0 on success, -1 if the table is not empty or the engine unknown */
+int hash_set_engine(struct hash_table* ht, int engine);
+
+/* Enable (1) or disable (0) Robin Hood insertion on an empty table using
+   the linear engine: a new key takes the place of any key closer to its
+   own home cell, lookups stop as soon as they meet a key closer to its
+   home than the searched one would be, and removals shift the following
+   keys back instead of leaving tombstones.
+   Return 0 on success, -1 if the table is not empty or uses the swiss
+   engine */
+int hash_set_robin_hood(struct hash_table* ht, int enable);
+
+/* Round the size of every shard of an empty table up to a power of two,
+   so that cells are selected by masking the digest. Other sizes use a
+   multiplication (fast range reduction); neither needs a division.
+   Return 0 on success, -1 if the table is not empty */
+int hash_set_power_of_two(struct hash_table* ht);
+
+/* Select the hashing function of an empty table: one of the built-in
+   functions above, any function with the same signature, or NULL for the
+   default. It is called with the table's random seed.
+   Return 0 on success, -1 if the table is not empty */
+int hash_set_hash_function(struct hash_table* ht, HashFunction function);
+
+/* Select how an empty table owns keys and elements:
+   - HASH_OWN_STRING (default): key and element are NUL-terminated strings,
+     each copied with strdup
+   - HASH_OWN_BORROWED: key and element pointers are stored as they are and
+     never freed; they must outlive the table or the removal of the key
+   - HASH_OWN_BINARY: elements are element_size bytes long and are copied
+     with the key into a single allocation, so any struct can be stored
+   Return 0 on success, -1 if the table is not empty or the mode invalid */
+int hash_set_ownership(struct hash_table* ht, int ownership,
+                       size_t element_size);
+
+/* Enable (1) or disable (0) the arena allocator of an empty table. Keys
+   and elements copied by the table are then bump-allocated in slabs owned
+   by each shard, removed ones are reused, and destroy_hash_table releases
+   the slabs without visiting the nodes. Blocks larger than 256 bytes
+   are allocated one by one but are released in the same way. It has no
+   effect with HASH_OWN_BORROWED.
+   Return 0 on success, -1 if the table is not empty or on failure */
+int hash_set_arena(struct hash_table* ht, int enable);
+
+/* Enable (1) or disable (0) incremental resizing. When enabled a resize
+   only allocates the new array: every following insert or remove moves a
+   bounded number of nodes from the old one, and lookups consult both
+   arrays until the migration is complete. */
+void hash_set_incremental_resize(struct hash_table* ht, int enable);
+
+/* Enable (1) or disable (0) the thread-local mode: inserts and removals
+   no longer take the shard's lock and lookups do not enter an epoch, so
+   the table must be used by a single thread at a time (handing it over,
+   e.g. through pthread_join, is allowed). Iteration, statistics and the
+   other functions still take their locks. It is meant for partial tables
+   filled by one worker each and combined with hash_merge_all. */
+void hash_set_thread_local(struct hash_table* ht, int enable);
+
+/* Set the number of threads (1 by default) that share the rehash of a
+   shard resized at once, that is without incremental resizing or by
+   hash_reserve and hash_compact: each one moves a contiguous range of the
+   old nodes, claiming the new ones with atomic operations, while the
+   shard's lock is held. Threads are started only for arrays of at least
+   64K nodes per thread, and not for Robin Hood tables. */
+void hash_set_resize_threads(struct hash_table* ht, size_t n_threads);
+
 #define EMPTY (void*) 0x00
 #define TOMBSTONE (void*) 0x01
 
+#define HASH_ENGINE_LINEAR 0
+#define HASH_ENGINE_SWISS 1
+
+#define HASH_OWN_STRING 0
+#define HASH_OWN_BORROWED 1
+#define HASH_OWN_BINARY 2
+
 #endif // _HASH_TABLE_H
@@ -0,0 +1,124 @@
+/*
+   Questo programma confronta l'allocazione di chiavi ed elementi con
+   malloc e con l'arena degli shard. Per entrambe le modalità le parole del
+   file, una per riga, vengono inserite in una HashTable con il numero di
+   occorrenze come elemento; vengono quindi stampati il tempo di
+   inserimento, i byte di heap occupati per chiave distinta (nodi compresi)
+   e il tempo impiegato da destroy_hash_table.
+   Devono essere forniti i seguenti parametri in fase d'invocazione:
+   - FILE: file contenente le parole, ad esempio words.txt
+   - N_SHARDS: numero di shard della HashTable (opzionale, default 1)
+*/
+
+#include "../lib/hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <time.h>
+
+
+void usage(void) {
+        printf("usage: bench-arena [FILE] [N_SHARDS]\n");
+}
+
+
+double now(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+size_t heap_bytes(void) {
+        struct mallinfo2 info = mallinfo2();
+
+        return info.uordblks + info.hblkhd;
+}
+
+
+void* increment(char* key, void* element, void* ctx) {
+        int counter = 0;
+
+        (void) key;
+        if (element != NULL) {
+                counter = strtol(element, NULL, 10);
+        }
+        sprintf(ctx, "%d", counter + 1);
+        return ctx;
+}
+
+
+void measure(const char* name, int arena, const char* file_name,
+             size_t n_shards) {
+        HashTable* ht;
+        FILE* fp;
+        char* buffer = NULL;
+        size_t buffer_size = 0;
+        char str[32];
+        ssize_t read;
+        size_t before;
+        size_t bytes;
+        size_t n_keys;
+        double start, insert, destroy;
+
+        fp = fopen(file_name, "r");
+        if (fp == NULL) {
+                perror("Errore apertura file");
+                exit(3);
+        }
+
+        before = heap_bytes();
+        ht = create_hash_table(1024, n_shards);
+        if (ht == NULL || hash_set_arena(ht, arena) != 0) {
+                perror("Errore creazione tabella");
+                exit(4);
+        }
+
+        start = now();
+        while ((read = getline(&buffer, &buffer_size, fp)) != -1) {
+                if (read > 0 && buffer[read - 1] == '\n') {
+                        buffer[read - 1] = '\0';
+                }
+                hash_upsert(ht, buffer, increment, str);
+        }
+        insert = now() - start;
+        free(buffer);
+        fclose(fp);
+
+        // Il buffer di getline è già stato liberato
+        bytes = heap_bytes() - before;
+        n_keys = hash_num_elements(ht);
+
+        start = now();
+        destroy_hash_table(ht);
+        destroy = now() - start;
+
+        printf("%-8s %10lu %10.3f %10.1f %10.3f\n",
+               name, n_keys, insert, (double) bytes / n_keys, destroy * 1e3);
+}
+
+
+int main(int argc, char** argv) {
+        size_t n_shards = 1;
+
+        if (argc != 2 && argc != 3) {
+                usage();
+                exit(1);
+        }
+        if (argc == 3) {
+                n_shards = strtol(argv[2], NULL, 10);
+        }
+        if (n_shards < 1) {
+                usage();
+                exit(2);
+        }
+
+        printf("%-8s %10s %10s %10s %10s\n",
+               "alloc", "keys", "insert s", "bytes/key", "destroy ms");
+        measure("malloc", 0, argv[1], n_shards);
+        measure("arena", 1, argv[1], n_shards);
+
+        return 0;
+}
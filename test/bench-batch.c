@@ -0,0 +1,203 @@
+/*
+   Questo programma confronta le operazioni su una chiave alla volta con le
+   operazioni a gruppi. Le parole del file, una per riga, vengono mescolate
+   e inserite in una HashTable, quindi cercate e infine rimosse, una alla
+   volta con hash_insert, hash_get e hash_remove oppure a gruppi di 1, 8, 32
+   e 128 chiavi con hash_insert_batch, hash_get_batch e hash_remove_batch.
+   Per ogni modalità vengono stampati i milioni di operazioni al secondo.
+   La tabella viene creata già della dimensione finale, così che nel
+   conteggio non rientrino i ridimensionamenti.
+   Devono essere forniti i seguenti parametri in fase d'invocazione:
+   - FILE: file contenente le parole, ad esempio words.txt
+   - N_SHARDS: numero di shard della HashTable (opzionale, default 1)
+*/
+
+#include "../lib/hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_BATCH 128
+
+size_t batch_sizes[] = {1, 8, 32, 128};
+
+
+void usage(void) {
+        printf("usage: bench-batch [FILE] [N_SHARDS]\n");
+}
+
+
+double now(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+ * Esegue inserimenti, ricerche e rimozioni di tutte le parole a gruppi di
+ * batch chiavi, oppure una alla volta con le funzioni singole se batch è 0.
+ */
+void measure(char** words, size_t* lens, size_t n_words, size_t n_shards,
+             size_t batch) {
+        HashTable* ht;
+        void* elements[MAX_BATCH];
+        char* ones[MAX_BATCH];
+        char name[32];
+        double start, insert, get, remove;
+        size_t i, n;
+
+        for (i = 0; i < MAX_BATCH; i++) {
+                ones[i] = "1";
+        }
+
+        ht = create_hash_table(n_words * 2, n_shards);
+        if (ht == NULL) {
+                exit(4);
+        }
+
+        start = now();
+        for (i = 0; i < n_words; i += n) {
+                n = batch == 0 ? 1 : batch;
+                if (n > n_words - i) {
+                        n = n_words - i;
+                }
+                if (batch == 0) {
+                        hash_insert_n(ht, words[i], lens[i], "1");
+                } else {
+                        hash_insert_batch(ht, words + i, lens + i, n,
+                                          (void**) ones, NULL);
+                }
+        }
+        insert = now() - start;
+
+        start = now();
+        for (i = 0; i < n_words; i += n) {
+                n = batch == 0 ? 1 : batch;
+                if (n > n_words - i) {
+                        n = n_words - i;
+                }
+                if (batch == 0) {
+                        elements[0] = hash_get_n(ht, words[i], lens[i]);
+                } else {
+                        hash_get_batch(ht, words + i, lens + i, n, elements);
+                }
+        }
+        get = now() - start;
+
+        start = now();
+        for (i = 0; i < n_words; i += n) {
+                n = batch == 0 ? 1 : batch;
+                if (n > n_words - i) {
+                        n = n_words - i;
+                }
+                if (batch == 0) {
+                        hash_remove_n(ht, words[i], lens[i]);
+                } else {
+                        hash_remove_batch(ht, words + i, lens + i, n, NULL);
+                }
+        }
+        remove = now() - start;
+
+        if (batch == 0) {
+                sprintf(name, "single");
+        } else {
+                sprintf(name, "batch %lu", batch);
+        }
+        printf("%-10s %10.2f %10.2f %10.2f\n", name,
+               n_words / insert / 1e6,
+               n_words / get / 1e6,
+               n_words / remove / 1e6);
+
+        destroy_hash_table(ht);
+}
+
+
+int main(int argc, char** argv) {
+        FILE* fp;
+        char* buffer = NULL;
+        size_t buffer_size = 0;
+        ssize_t read;
+        char** words = NULL;
+        size_t* lens = NULL;
+        char* swap;
+        size_t swap_len;
+        size_t n_words = 0;
+        size_t capacity = 0;
+        size_t n_shards = 1;
+        size_t i, j;
+
+        if (argc != 2 && argc != 3) {
+                usage();
+                exit(1);
+        }
+        if (argc == 3) {
+                n_shards = strtol(argv[2], NULL, 10);
+        }
+        if (n_shards < 1) {
+                usage();
+                exit(2);
+        }
+
+        fp = fopen(argv[1], "r");
+        if (fp == NULL) {
+                perror("Errore apertura file");
+                exit(3);
+        }
+
+        // Carico le parole in memoria, senza il carattere di a capo
+        while ((read = getline(&buffer, &buffer_size, fp)) != -1) {
+                if (read > 0 && buffer[read - 1] == '\n') {
+                        buffer[--read] = '\0';
+                }
+                if (n_words == capacity) {
+                        capacity = capacity ? capacity * 2 : 1024;
+                        words = realloc(words, capacity * sizeof(char*));
+                        lens = realloc(lens, capacity * sizeof(size_t));
+                        if (words == NULL || lens == NULL) {
+                                perror("Errore allocazione");
+                                exit(3);
+                        }
+                }
+                words[n_words] = strdup(buffer);
+                lens[n_words] = read;
+                n_words++;
+        }
+        free(buffer);
+        fclose(fp);
+
+        if (n_words == 0) {
+                perror("File vuoto");
+                exit(3);
+        }
+
+        // Mescolo le parole, così che chiavi consecutive non tocchino
+        // celle vicine
+        srand(1);
+        for (i = n_words - 1; i > 0; i--) {
+                j = rand() % (i + 1);
+                swap = words[i];
+                words[i] = words[j];
+                words[j] = swap;
+                swap_len = lens[i];
+                lens[i] = lens[j];
+                lens[j] = swap_len;
+        }
+
+        printf("%-10s %10s %10s %10s\n",
+               "mode", "insert M/s", "get M/s", "remove M/s");
+        measure(words, lens, n_words, n_shards, 0);
+        for (i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); i++) {
+                measure(words, lens, n_words, n_shards, batch_sizes[i]);
+        }
+
+        for (i = 0; i < n_words; i++) {
+                free(words[i]);
+        }
+        free(words);
+        free(lens);
+
+        return 0;
+}
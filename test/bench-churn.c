@@ -0,0 +1,125 @@
+/*
+   Questo programma misura la HashTable sotto un carico stazionario di
+   inserimenti e rimozioni: la tabella viene riempita con N_KEYS chiavi,
+   dopodiché ogni passo rimuove una chiave presente e ne inserisce una
+   nuova, così che il numero di elementi resti costante. Vengono confrontati
+   il linear probing con TOMBSTONE e la politica Robin Hood, stampando le
+   operazioni al secondo durante il ricambio e quelle delle ricerche di
+   chiavi presenti e assenti al termine dello stesso. Le ultime righe
+   ripetono il linear probing con densità di espansione 95 e 99 e una
+   tabella riempita quasi fino a quella densità, dove le TOMBSTONE lasciano
+   pochi nodi EMPTY; per ogni politica viene stampato anche il numero di
+   ricostruzioni e di espansioni avvenute durante il ricambio.
+   Devono essere forniti i seguenti parametri in fase d'invocazione:
+   - N_KEYS: numero di chiavi presenti nella tabella
+   - N_STEPS: numero di passi di ricambio
+*/
+
+#include "../lib/hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+void usage(void) {
+        printf("usage: bench-churn [N_KEYS] [N_STEPS]\n");
+}
+
+
+double now(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+ * Con density pari a 0 la tabella ha il doppio delle celle delle chiavi e
+ * la densità di espansione predefinita, altrimenti viene impostata la
+ * densità data e la tabella viene riempita fino a un punto sotto di essa.
+ */
+void measure(const char* name, int robin_hood, int density, long n_keys,
+             long n_steps) {
+        HashTable* ht;
+        HashStats stats;
+        double start;
+        double churn, hit, miss;
+        char key[32];
+        long i;
+
+        ht = create_hash_table(density == 0 ? n_keys * 2 :
+                               n_keys * 100 / (density - 1), 1);
+        if (ht == NULL) {
+                exit(3);
+        }
+        if (robin_hood && hash_set_robin_hood(ht, 1) != 0) {
+                perror("Errore impostazione Robin Hood");
+                exit(4);
+        }
+        if (density != 0) {
+                hash_set_resize_high_density(ht, density);
+        }
+
+        for (i = 0; i < n_keys; i++) {
+                sprintf(key, "key-%ld", i);
+                hash_insert(ht, key, "1");
+        }
+
+        // Ad ogni passo la chiave più vecchia viene sostituita
+        start = now();
+        for (i = 0; i < n_steps; i++) {
+                sprintf(key, "key-%ld", i);
+                hash_remove(ht, key);
+                sprintf(key, "key-%ld", i + n_keys);
+                hash_insert(ht, key, "1");
+        }
+        churn = 2.0 * n_steps / (now() - start);
+        hash_stats(ht, &stats);
+
+        start = now();
+        for (i = 0; i < n_keys; i++) {
+                sprintf(key, "key-%ld", n_steps + i);
+                hash_get(ht, key);
+        }
+        hit = n_keys / (now() - start);
+
+        start = now();
+        for (i = 0; i < n_keys; i++) {
+                sprintf(key, "miss-%ld", i);
+                hash_get(ht, key);
+        }
+        miss = n_keys / (now() - start);
+
+        printf("%-12s\t %12.0f\t %12.0f\t %12.0f\t %12lu\t %12lu\n", name,
+               churn, hit, miss, stats.compactions, stats.expansions);
+        destroy_hash_table(ht);
+}
+
+
+int main(int argc, char** argv) {
+        long n_keys;
+        long n_steps;
+
+        if (argc != 3) {
+                usage();
+                exit(1);
+        }
+
+        n_keys = strtol(argv[1], NULL, 10);
+        n_steps = strtol(argv[2], NULL, 10);
+        if (n_keys < 1 || n_steps < 1) {
+                usage();
+                exit(2);
+        }
+
+        printf("policy\t\t churn ops/s\t hit ops/s\t miss ops/s\t "
+               "compactions\t expansions\n");
+        measure("linear", 0, 0, n_keys, n_steps);
+        measure("robin-hood", 1, 0, n_keys, n_steps);
+        measure("linear-95", 0, 95, n_keys, n_steps);
+        measure("linear-99", 0, 99, n_keys, n_steps);
+
+        return 0;
+}
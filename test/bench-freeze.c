@@ -0,0 +1,209 @@
+/*
+   Questo programma confronta una HashTable con la sua copia congelata da
+   hash_freeze. Le parole del file, una per riga, vengono inserite in una
+   HashTable che viene poi congelata; per entrambe vengono stampati i byte
+   di heap per chiave distinta e i nanosecondi medi di una ricerca di
+   chiavi presenti e di chiavi assenti, lette in ordine casuale, anche a
+   gruppi di 32 con hash_get_batch, oltre al tempo impiegato per congelare
+   la tabella.
+   Devono essere forniti i seguenti parametri in fase d'invocazione:
+   - FILE: file contenente le parole, ad esempio words.txt
+   - ROUNDS: numero di passate di ricerca (opzionale, default 5)
+*/
+
+#include "../lib/hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <time.h>
+
+#define BATCH 32
+
+
+void usage(void) {
+        printf("usage: bench-freeze [FILE] [ROUNDS]\n");
+}
+
+
+double now(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+size_t heap_bytes(void) {
+        struct mallinfo2 info = mallinfo2();
+
+        return info.uordblks + info.hblkhd;
+}
+
+
+/*
+ * Cerca tutte le chiavi rounds volte e restituisce i nanosecondi medi di
+ * una ricerca.
+ */
+double lookups(HashTable* ht, char** keys, size_t n_keys, long rounds) {
+        volatile size_t found = 0;
+        double start;
+        size_t i;
+        long r;
+
+        start = now();
+        for (r = 0; r < rounds; r++) {
+                for (i = 0; i < n_keys; i++) {
+                        found += hash_get(ht, keys[i]) != NULL;
+                }
+        }
+        return (now() - start) * 1e9 / (n_keys * rounds);
+}
+
+
+/*
+ * Come lookups, a gruppi di BATCH chiavi con hash_get_batch.
+ */
+double batch_lookups(HashTable* ht, char** keys, size_t n_keys,
+                     long rounds) {
+        void* elements[BATCH];
+        volatile size_t found = 0;
+        double start;
+        size_t i, n;
+        long r;
+
+        start = now();
+        for (r = 0; r < rounds; r++) {
+                for (i = 0; i < n_keys; i += n) {
+                        n = n_keys - i < BATCH ? n_keys - i : BATCH;
+                        found += hash_get_batch(ht, keys + i, NULL, n,
+                                                elements);
+                }
+        }
+        return (now() - start) * 1e9 / (n_keys * rounds);
+}
+
+
+int main(int argc, char** argv) {
+        HashTable* ht;
+        HashTable* frozen;
+        FILE* fp;
+        char* buffer = NULL;
+        size_t buffer_size = 0;
+        ssize_t read;
+        char** words = NULL;
+        char** misses;
+        char* swap;
+        size_t n_words = 0;
+        size_t capacity = 0;
+        size_t before, bytes, frozen_bytes, n_keys;
+        size_t i, j;
+        long rounds = 5;
+        double start, freeze;
+
+        if (argc != 2 && argc != 3) {
+                usage();
+                exit(1);
+        }
+        if (argc == 3) {
+                rounds = strtol(argv[2], NULL, 10);
+        }
+        if (rounds < 1) {
+                usage();
+                exit(2);
+        }
+
+        fp = fopen(argv[1], "r");
+        if (fp == NULL) {
+                perror("Errore apertura file");
+                exit(3);
+        }
+        while ((read = getline(&buffer, &buffer_size, fp)) != -1) {
+                if (read > 0 && buffer[read - 1] == '\n') {
+                        buffer[read - 1] = '\0';
+                }
+                if (n_words == capacity) {
+                        capacity = capacity ? capacity * 2 : 1024;
+                        words = realloc(words, capacity * sizeof(char*));
+                        if (words == NULL) {
+                                perror("Errore allocazione");
+                                exit(3);
+                        }
+                }
+                words[n_words++] = strdup(buffer);
+        }
+        free(buffer);
+        fclose(fp);
+        if (n_words == 0) {
+                perror("File vuoto");
+                exit(3);
+        }
+
+        // Mescolo le parole, così che le ricerche non seguano l'ordine
+        // d'inserimento, e preparo altrettante chiavi assenti
+        srand(1);
+        for (i = n_words - 1; i > 0; i--) {
+                j = rand() % (i + 1);
+                swap = words[i];
+                words[i] = words[j];
+                words[j] = swap;
+        }
+        misses = malloc(n_words * sizeof(char*));
+        if (misses == NULL) {
+                perror("Errore allocazione");
+                exit(3);
+        }
+        for (i = 0; i < n_words; i++) {
+                misses[i] = malloc(strlen(words[i]) + 2);
+                if (misses[i] == NULL) {
+                        perror("Errore allocazione");
+                        exit(3);
+                }
+                sprintf(misses[i], "%s#", words[i]);
+        }
+
+        before = heap_bytes();
+        ht = create_hash_table(1024, 1);
+        if (ht == NULL) {
+                exit(4);
+        }
+        for (i = 0; i < n_words; i++) {
+                hash_insert(ht, words[i], "1");
+        }
+        bytes = heap_bytes() - before;
+        n_keys = hash_num_elements(ht);
+
+        before = heap_bytes();
+        start = now();
+        frozen = hash_freeze(ht);
+        freeze = now() - start;
+        if (frozen == NULL) {
+                exit(4);
+        }
+        frozen_bytes = heap_bytes() - before;
+
+        printf("%-8s %10s %10s %10s %10s %10s\n", "table", "keys",
+               "bytes/key", "hit ns", "miss ns", "batch ns");
+        printf("%-8s %10lu %10.1f %10.1f %10.1f %10.1f\n", "mutable",
+               n_keys, (double) bytes / n_keys,
+               lookups(ht, words, n_words, rounds),
+               lookups(ht, misses, n_words, rounds),
+               batch_lookups(ht, words, n_words, rounds));
+        printf("%-8s %10lu %10.1f %10.1f %10.1f %10.1f\n", "frozen",
+               hash_num_elements(frozen), (double) frozen_bytes / n_keys,
+               lookups(frozen, words, n_words, rounds),
+               lookups(frozen, misses, n_words, rounds),
+               batch_lookups(frozen, words, n_words, rounds));
+        printf("freeze: %.3f s\n", freeze);
+
+        destroy_hash_table(frozen);
+        destroy_hash_table(ht);
+        for (i = 0; i < n_words; i++) {
+                free(words[i]);
+                free(misses[i]);
+        }
+        free(words);
+        free(misses);
+
+        return 0;
+}
@@ -0,0 +1,175 @@
+/*
+   Questo programma confronta le funzioni di hash fornite dalla libreria
+   sulle parole di un file, una per riga. Per ogni funzione viene stampata
+   la velocità di calcolo (MB/s e nanosecondi per chiave) e la
+   distribuzione delle lunghezze di probing che ne risulta in una tabella
+   con dimensione potenza di due: la percentuale di chiavi trovate nella
+   propria cella, a distanza 1, 2-3, 4-7, 8 o più, la media e il massimo.
+   Devono essere forniti i seguenti parametri in fase d'invocazione:
+   - FILE: file contenente le parole, ad esempio words.txt
+   - ROUNDS: numero di passate sulle parole per la misura della velocità
+     (opzionale, default 20)
+*/
+
+#include "../lib/hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct function {
+        const char* name;
+        HashFunction function;
+};
+
+struct function functions[] = {
+        {"wyhash", hash_wyhash},
+        {"fnv1a", hash_fnv1a},
+        {"sdbm", hash_sdbm},
+        {"djb2", hash_djb2},
+};
+
+
+void usage(void) {
+        printf("usage: bench-hash [FILE] [ROUNDS]\n");
+}
+
+
+double now(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void measure(struct function* f, char** words, size_t* lens,
+             size_t n_words, long rounds) {
+        HashTable* ht;
+        HashStats stats;
+        volatile size_t sink = 0;
+        size_t histogram[5] = {0, 0, 0, 0, 0};
+        size_t bytes = 0;
+        size_t probe;
+        double start, elapsed;
+        long r;
+        size_t i;
+
+        // Velocità della sola funzione di hash
+        start = now();
+        for (r = 0; r < rounds; r++) {
+                for (i = 0; i < n_words; i++) {
+                        sink += f->function(words[i], lens[i], (size_t) r);
+                        bytes += lens[i];
+                }
+        }
+        elapsed = now() - start;
+        (void) sink;
+
+        // Distribuzione delle lunghezze di probing in una tabella reale
+        ht = create_hash_table(1024, 1);
+        if (ht == NULL || hash_set_power_of_two(ht) != 0 ||
+            hash_set_hash_function(ht, f->function) != 0) {
+                perror("Errore creazione tabella");
+                exit(4);
+        }
+        for (i = 0; i < n_words; i++) {
+                hash_insert(ht, words[i], "1");
+        }
+
+        // Raggruppo l'istogramma delle lunghezze di probing della tabella
+        hash_stats(ht, &stats);
+        for (probe = 0; probe < HASH_STATS_PROBES; probe++) {
+                histogram[probe == 0 ? 0 :
+                          probe == 1 ? 1 :
+                          probe < 4 ? 2 :
+                          probe < 8 ? 3 : 4] += stats.probe_histogram[probe];
+        }
+
+        printf("%-8s %8.0f %8.2f %6.1f %6.1f %6.1f %6.1f %6.1f %6.2f %6lu\n",
+               f->name,
+               bytes / elapsed / 1e6,
+               elapsed * 1e9 / (n_words * rounds),
+               100.0 * histogram[0] / stats.elements,
+               100.0 * histogram[1] / stats.elements,
+               100.0 * histogram[2] / stats.elements,
+               100.0 * histogram[3] / stats.elements,
+               100.0 * histogram[4] / stats.elements,
+               stats.mean_probe,
+               stats.max_probe);
+
+        destroy_hash_table(ht);
+}
+
+
+int main(int argc, char** argv) {
+        FILE* fp;
+        char* buffer = NULL;
+        size_t buffer_size = 0;
+        ssize_t read;
+        char** words = NULL;
+        size_t* lens = NULL;
+        size_t n_words = 0;
+        size_t capacity = 0;
+        long rounds = 20;
+        size_t i;
+
+        if (argc != 2 && argc != 3) {
+                usage();
+                exit(1);
+        }
+        if (argc == 3) {
+                rounds = strtol(argv[2], NULL, 10);
+        }
+        if (rounds < 1) {
+                usage();
+                exit(2);
+        }
+
+        fp = fopen(argv[1], "r");
+        if (fp == NULL) {
+                perror("Errore apertura file");
+                exit(3);
+        }
+
+        // Carico le parole in memoria, senza il carattere di a capo
+        while ((read = getline(&buffer, &buffer_size, fp)) != -1) {
+                if (read > 0 && buffer[read - 1] == '\n') {
+                        buffer[--read] = '\0';
+                }
+                if (n_words == capacity) {
+                        capacity = capacity ? capacity * 2 : 1024;
+                        words = realloc(words, capacity * sizeof(char*));
+                        lens = realloc(lens, capacity * sizeof(size_t));
+                        if (words == NULL || lens == NULL) {
+                                perror("Errore allocazione");
+                                exit(3);
+                        }
+                }
+                words[n_words] = strdup(buffer);
+                lens[n_words] = read;
+                n_words++;
+        }
+        free(buffer);
+        fclose(fp);
+
+        if (n_words == 0) {
+                perror("File vuoto");
+                exit(3);
+        }
+
+        printf("%-8s %8s %8s %6s %6s %6s %6s %6s %6s %6s\n",
+               "hash", "MB/s", "ns/key", "0", "1", "2-3", "4-7", "8+",
+               "mean", "max");
+        for (i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+                measure(&functions[i], words, lens, n_words, rounds);
+        }
+
+        for (i = 0; i < n_words; i++) {
+                free(words[i]);
+        }
+        free(words);
+        free(lens);
+
+        return 0;
+}
@@ -0,0 +1,172 @@
+/*
+   Questo programma confronta l'avvio di una tabella ricostruita dal file
+   di parole con quello di una tabella aperta dalla sua immagine. Le
+   parole del file, una per riga, vengono contate in una HashTable come
+   fa demo, la tabella viene salvata con hash_save e riaperta con
+   hash_open_mmap; vengono quindi stampati i tempi di ricostruzione,
+   salvataggio e apertura, i nanosecondi medi di una ricerca su entrambe
+   le tabelle e il numero di parole il cui contatore non coincide.
+   Devono essere forniti i seguenti parametri in fase d'invocazione:
+   - FILE: file contenente le parole, ad esempio words.txt
+   - IMAGE: file in cui salvare l'immagine della tabella
+   - N_SHARDS: numero di shard della HashTable (opzionale, default 1)
+*/
+
+#include "../lib/hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+void usage(void) {
+        printf("usage: bench-image [FILE] [IMAGE] [N_SHARDS]\n");
+}
+
+
+double now(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void* increment(char* key, void* element, void* ctx) {
+        int counter = 0;
+
+        (void) key;
+        if (element != NULL) {
+                counter = strtol(element, NULL, 10);
+        }
+        sprintf(ctx, "%d", counter + 1);
+        return ctx;
+}
+
+
+/*
+ * Cerca tutte le parole e restituisce i nanosecondi medi di una ricerca.
+ */
+double lookups(HashTable* ht, char** words, size_t n_words) {
+        volatile size_t found = 0;
+        double start;
+        size_t i;
+
+        start = now();
+        for (i = 0; i < n_words; i++) {
+                found += hash_get(ht, words[i]) != NULL;
+        }
+        return (now() - start) * 1e9 / n_words;
+}
+
+
+int main(int argc, char** argv) {
+        HashTable* ht;
+        HashTable* mapped;
+        FILE* fp;
+        char* buffer = NULL;
+        size_t buffer_size = 0;
+        char str[32];
+        ssize_t read;
+        char** words = NULL;
+        size_t n_words = 0;
+        size_t capacity = 0;
+        size_t n_shards = 1;
+        size_t mismatches = 0;
+        size_t i;
+        char* a;
+        char* b;
+        double start, build, save, open, built_get, mapped_get;
+
+        if (argc != 3 && argc != 4) {
+                usage();
+                exit(1);
+        }
+        if (argc == 4) {
+                n_shards = strtol(argv[3], NULL, 10);
+        }
+        if (n_shards < 1) {
+                usage();
+                exit(2);
+        }
+
+        fp = fopen(argv[1], "r");
+        if (fp == NULL) {
+                perror("Errore apertura file");
+                exit(3);
+        }
+
+        ht = create_hash_table(1024, n_shards);
+        if (ht == NULL) {
+                exit(4);
+        }
+
+        // Ricostruisco la tabella dal file, tenendo le parole per le
+        // ricerche successive
+        start = now();
+        while ((read = getline(&buffer, &buffer_size, fp)) != -1) {
+                if (read > 0 && buffer[read - 1] == '\n') {
+                        buffer[--read] = '\0';
+                }
+                hash_upsert_n(ht, buffer, read, increment, str);
+                if (n_words == capacity) {
+                        capacity = capacity ? capacity * 2 : 1024;
+                        words = realloc(words, capacity * sizeof(char*));
+                        if (words == NULL) {
+                                perror("Errore allocazione");
+                                exit(3);
+                        }
+                }
+                words[n_words++] = strdup(buffer);
+        }
+        build = now() - start;
+        free(buffer);
+        fclose(fp);
+
+        if (n_words == 0) {
+                perror("File vuoto");
+                exit(3);
+        }
+
+        start = now();
+        if (hash_save(ht, argv[2]) != 0) {
+                exit(4);
+        }
+        save = now() - start;
+
+        start = now();
+        mapped = hash_open_mmap(argv[2]);
+        if (mapped == NULL) {
+                exit(4);
+        }
+        open = now() - start;
+
+        built_get = lookups(ht, words, n_words);
+        mapped_get = lookups(mapped, words, n_words);
+
+        for (i = 0; i < n_words; i++) {
+                a = hash_get(ht, words[i]);
+                b = hash_get(mapped, words[i]);
+                if (a == NULL || b == NULL || strcmp(a, b) != 0) {
+                        mismatches++;
+                }
+        }
+        if (hash_num_elements(ht) != hash_num_elements(mapped)) {
+                mismatches++;
+        }
+
+        printf("%10s %10s %10s %10s %10s %10s %10s\n", "keys", "build s",
+               "save s", "open ms", "get ns", "mmap ns", "mismatch");
+        printf("%10lu %10.3f %10.3f %10.3f %10.1f %10.1f %10lu\n",
+               hash_num_elements(mapped), build, save, open * 1e3,
+               built_get, mapped_get, mismatches);
+
+        destroy_hash_table(mapped);
+        destroy_hash_table(ht);
+        for (i = 0; i < n_words; i++) {
+                free(words[i]);
+        }
+        free(words);
+
+        return mismatches != 0;
+}
@@ -0,0 +1,162 @@
+/*
+   Questo programma misura la memoria occupata dalle chiavi e la latenza
+   delle ricerche. Le parole del file, una per riga, vengono inserite in
+   una HashTable; vengono quindi stampati i byte di heap per chiave
+   distinta (nodi compresi) e i nanosecondi medi di una ricerca di chiavi
+   presenti e di chiavi assenti, lette in ordine casuale così che ogni
+   ricerca tocchi memoria non in cache. La tabella viene creata già della
+   dimensione finale, così che nel conteggio non rientrino gli array
+   ritirati dai ridimensionamenti.
+   Devono essere forniti i seguenti parametri in fase d'invocazione:
+   - FILE: file contenente le parole, ad esempio words.txt
+   - ROUNDS: numero di passate di ricerca (opzionale, default 5)
+*/
+
+#include "../lib/hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <time.h>
+
+
+void usage(void) {
+        printf("usage: bench-keys [FILE] [ROUNDS]\n");
+}
+
+
+double now(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+size_t heap_bytes(void) {
+        struct mallinfo2 info = mallinfo2();
+
+        return info.uordblks + info.hblkhd;
+}
+
+
+int main(int argc, char** argv) {
+        HashTable* ht;
+        FILE* fp;
+        char* buffer = NULL;
+        size_t buffer_size = 0;
+        ssize_t read;
+        char** words = NULL;
+        char** misses;
+        char* swap;
+        size_t n_words = 0;
+        size_t capacity = 0;
+        size_t before, bytes, n_keys;
+        size_t i, j;
+        long rounds = 5;
+        long r;
+        double start, hit, miss;
+        volatile size_t found = 0;
+
+        if (argc != 2 && argc != 3) {
+                usage();
+                exit(1);
+        }
+        if (argc == 3) {
+                rounds = strtol(argv[2], NULL, 10);
+        }
+        if (rounds < 1) {
+                usage();
+                exit(2);
+        }
+
+        fp = fopen(argv[1], "r");
+        if (fp == NULL) {
+                perror("Errore apertura file");
+                exit(3);
+        }
+        while ((read = getline(&buffer, &buffer_size, fp)) != -1) {
+                if (read > 0 && buffer[read - 1] == '\n') {
+                        buffer[read - 1] = '\0';
+                }
+                if (n_words == capacity) {
+                        capacity = capacity ? capacity * 2 : 1024;
+                        words = realloc(words, capacity * sizeof(char*));
+                        if (words == NULL) {
+                                perror("Errore allocazione");
+                                exit(3);
+                        }
+                }
+                words[n_words++] = strdup(buffer);
+        }
+        free(buffer);
+        fclose(fp);
+        if (n_words == 0) {
+                perror("File vuoto");
+                exit(3);
+        }
+
+        // Mescolo le parole, così che le ricerche non seguano l'ordine
+        // d'inserimento, e preparo altrettante chiavi assenti
+        srand(1);
+        for (i = n_words - 1; i > 0; i--) {
+                j = rand() % (i + 1);
+                swap = words[i];
+                words[i] = words[j];
+                words[j] = swap;
+        }
+        misses = malloc(n_words * sizeof(char*));
+        if (misses == NULL) {
+                perror("Errore allocazione");
+                exit(3);
+        }
+        for (i = 0; i < n_words; i++) {
+                misses[i] = malloc(strlen(words[i]) + 2);
+                if (misses[i] == NULL) {
+                        perror("Errore allocazione");
+                        exit(3);
+                }
+                sprintf(misses[i], "%s#", words[i]);
+        }
+
+        before = heap_bytes();
+        ht = create_hash_table(n_words * 2, 1);
+        if (ht == NULL) {
+                exit(4);
+        }
+        for (i = 0; i < n_words; i++) {
+                hash_insert(ht, words[i], "1");
+        }
+        bytes = heap_bytes() - before;
+        n_keys = hash_num_elements(ht);
+
+        start = now();
+        for (r = 0; r < rounds; r++) {
+                for (i = 0; i < n_words; i++) {
+                        found += hash_get(ht, words[i]) != NULL;
+                }
+        }
+        hit = (now() - start) * 1e9 / (n_words * rounds);
+
+        start = now();
+        for (r = 0; r < rounds; r++) {
+                for (i = 0; i < n_words; i++) {
+                        found += hash_get(ht, misses[i]) != NULL;
+                }
+        }
+        miss = (now() - start) * 1e9 / (n_words * rounds);
+
+        printf("%10s %10s %10s %10s\n", "keys", "bytes/key", "hit ns", "miss ns");
+        printf("%10lu %10.1f %10.1f %10.1f\n",
+               n_keys, (double) bytes / n_keys, hit, miss);
+
+        destroy_hash_table(ht);
+        for (i = 0; i < n_words; i++) {
+                free(words[i]);
+                free(misses[i]);
+        }
+        free(words);
+        free(misses);
+
+        return 0;
+}
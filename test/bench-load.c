@@ -0,0 +1,162 @@
+/*
+   Questo programma misura il caricamento iniziale di una HashTable con
+   tutte le parole del file, una per riga, partendo da una tabella di 1024
+   celle: con hash_insert lasciando che la tabella si espanda, con
+   hash_insert dopo hash_reserve e con hash_bulk_load. Per ogni modalità
+   vengono stampati il tempo impiegato, le chiavi distinte e il numero di
+   espansioni riportato da hash_stats.
+   Devono essere forniti i seguenti parametri in fase d'invocazione:
+   - FILE: file contenente le parole, ad esempio words.txt
+   - N_SHARDS: numero di shard della HashTable (opzionale, default 1)
+   - N_THREADS: thread usati da hash_bulk_load (opzionale, default 1)
+*/
+
+#include "../lib/hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MODE_INSERT 0
+#define MODE_RESERVE 1
+#define MODE_BULK 2
+
+
+void usage(void) {
+        printf("usage: bench-load [FILE] [N_SHARDS] [N_THREADS]\n");
+}
+
+
+double now(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void measure(const char* name, int mode, char** words, size_t* lens,
+             void** ones, size_t n_words, size_t n_shards, size_t n_threads) {
+        HashTable* ht;
+        HashStats stats;
+        double start, elapsed;
+        size_t i;
+
+        ht = create_hash_table(1024, n_shards);
+        if (ht == NULL) {
+                exit(4);
+        }
+
+        start = now();
+        if (mode == MODE_BULK) {
+                if (hash_bulk_load(ht, words, lens, ones, n_words,
+                                   n_threads) != 0) {
+                        perror("Errore caricamento");
+                        exit(4);
+                }
+        } else {
+                if (mode == MODE_RESERVE && hash_reserve(ht, n_words) != 0) {
+                        perror("Errore riserva");
+                        exit(4);
+                }
+                for (i = 0; i < n_words; i++) {
+                        hash_insert_n(ht, words[i], lens[i], ones[i]);
+                }
+        }
+        elapsed = now() - start;
+
+        hash_stats(ht, &stats);
+        printf("%-8s %10.3f %10lu %10lu\n",
+               name, elapsed, stats.elements, stats.expansions);
+
+        destroy_hash_table(ht);
+}
+
+
+int main(int argc, char** argv) {
+        FILE* fp;
+        char* buffer = NULL;
+        size_t buffer_size = 0;
+        ssize_t read;
+        char** words = NULL;
+        size_t* lens = NULL;
+        void** ones;
+        size_t n_words = 0;
+        size_t capacity = 0;
+        size_t n_shards = 1;
+        size_t n_threads = 1;
+        size_t i;
+
+        if (argc < 2 || argc > 4) {
+                usage();
+                exit(1);
+        }
+        if (argc >= 3) {
+                n_shards = strtol(argv[2], NULL, 10);
+        }
+        if (argc == 4) {
+                n_threads = strtol(argv[3], NULL, 10);
+        }
+        if (n_shards < 1 || n_threads < 1) {
+                usage();
+                exit(2);
+        }
+
+        fp = fopen(argv[1], "r");
+        if (fp == NULL) {
+                perror("Errore apertura file");
+                exit(3);
+        }
+
+        // Carico le parole in memoria, senza il carattere di a capo
+        while ((read = getline(&buffer, &buffer_size, fp)) != -1) {
+                if (read > 0 && buffer[read - 1] == '\n') {
+                        buffer[--read] = '\0';
+                }
+                if (n_words == capacity) {
+                        capacity = capacity ? capacity * 2 : 1024;
+                        words = realloc(words, capacity * sizeof(char*));
+                        lens = realloc(lens, capacity * sizeof(size_t));
+                        if (words == NULL || lens == NULL) {
+                                perror("Errore allocazione");
+                                exit(3);
+                        }
+                }
+                words[n_words] = strdup(buffer);
+                lens[n_words] = read;
+                n_words++;
+        }
+        free(buffer);
+        fclose(fp);
+
+        if (n_words == 0) {
+                perror("File vuoto");
+                exit(3);
+        }
+
+        ones = malloc(n_words * sizeof(void*));
+        if (ones == NULL) {
+                perror("Errore allocazione");
+                exit(3);
+        }
+        for (i = 0; i < n_words; i++) {
+                ones[i] = "1";
+        }
+
+        printf("%-8s %10s %10s %10s\n", "mode", "seconds", "keys", "expansions");
+        measure("insert", MODE_INSERT, words, lens, ones, n_words,
+                n_shards, n_threads);
+        measure("reserve", MODE_RESERVE, words, lens, ones, n_words,
+                n_shards, n_threads);
+        measure("bulk", MODE_BULK, words, lens, ones, n_words,
+                n_shards, n_threads);
+
+        for (i = 0; i < n_words; i++) {
+                free(words[i]);
+        }
+        free(words);
+        free(lens);
+        free(ones);
+
+        return 0;
+}
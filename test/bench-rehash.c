@@ -0,0 +1,116 @@
+/*
+   Questo programma misura la durata del rehash di uno shard al variare
+   del numero di thread impostato con hash_set_resize_threads. Per ogni
+   numero di thread (1, 2, 4, ... fino a MAX_THREADS) una HashTable con un
+   solo shard viene riempita a metà con N_ENTRIES chiavi generate, quindi
+   viene portata con hash_reserve al doppio delle chiavi, il che sposta
+   tutte le chiavi in un array più grande tenendo il lock dello shard.
+   Vengono stampati i secondi di quella pausa e l'accelerazione rispetto
+   a un solo thread; alcune chiavi vengono poi cercate per controllo.
+   Devono essere forniti i seguenti parametri in fase d'invocazione:
+   - N_ENTRIES: numero di chiavi (opzionale, default 10000000)
+   - MAX_THREADS: numero massimo di thread (opzionale, default 8)
+*/
+
+#include "../lib/hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KEY_STRIDE 16
+
+
+void usage(void) {
+        printf("usage: bench-rehash [N_ENTRIES] [MAX_THREADS]\n");
+}
+
+
+double now(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int main(int argc, char** argv) {
+        HashTable* ht;
+        char* keys;
+        size_t* lens;
+        size_t n_entries = 10000000;
+        size_t max_threads = 8;
+        size_t missing;
+        size_t threads, i;
+        double start, elapsed, single = 0;
+
+        if (argc > 3) {
+                usage();
+                exit(1);
+        }
+        if (argc >= 2) {
+                n_entries = strtol(argv[1], NULL, 10);
+        }
+        if (argc == 3) {
+                max_threads = strtol(argv[2], NULL, 10);
+        }
+        if (n_entries < 1 || max_threads < 1) {
+                usage();
+                exit(2);
+        }
+
+        // Le chiavi sono abbastanza corte da essere copiate nei nodi
+        keys = malloc(n_entries * KEY_STRIDE);
+        lens = malloc(n_entries * sizeof(size_t));
+        if (keys == NULL || lens == NULL) {
+                perror("Errore allocazione");
+                exit(3);
+        }
+        for (i = 0; i < n_entries; i++) {
+                lens[i] = sprintf(keys + i * KEY_STRIDE, "k%lu", i);
+        }
+
+        printf("%10s %10s %10s %10s\n", "entries", "threads", "seconds",
+               "speedup");
+        for (threads = 1; threads <= max_threads; threads *= 2) {
+                ht = create_hash_table(n_entries * 2, 1);
+                if (ht == NULL ||
+                    hash_set_ownership(ht, HASH_OWN_BORROWED, 0) != 0) {
+                        exit(4);
+                }
+                for (i = 0; i < n_entries; i++) {
+                        hash_insert_n(ht, keys + i * KEY_STRIDE, lens[i],
+                                      "1");
+                }
+                hash_set_resize_threads(ht, threads);
+
+                start = now();
+                if (hash_reserve(ht, n_entries * 2) != 0) {
+                        perror("Errore riserva");
+                        exit(4);
+                }
+                elapsed = now() - start;
+                if (threads == 1) {
+                        single = elapsed;
+                }
+
+                missing = 0;
+                for (i = 0; i < n_entries; i += 997) {
+                        missing += hash_get_n(ht, keys + i * KEY_STRIDE,
+                                              lens[i]) == NULL;
+                }
+                if (missing > 0 || hash_num_elements(ht) != n_entries) {
+                        printf("chiavi perse: %lu\n", missing);
+                        exit(5);
+                }
+
+                printf("%10lu %10lu %10.3f %10.2f\n", n_entries, threads,
+                       elapsed, single / elapsed);
+                destroy_hash_table(ht);
+        }
+
+        free(keys);
+        free(lens);
+
+        return 0;
+}
@@ -0,0 +1,95 @@
+/*
+   Questo programma misura la latenza dei singoli inserimenti in una
+   HashTable che parte piccola e viene quindi ridimensionata più volte,
+   confrontando il ridimensionamento classico, che rialloca tutto l'array
+   durante un solo inserimento, con quello incrementale. Per entrambe le
+   modalità vengono stampati i percentili p50, p99, p99.9 e la pausa
+   massima in microsecondi.
+   Devono essere forniti i seguenti parametri in fase d'invocazione:
+   - N_KEYS: numero di chiavi da inserire
+*/
+
+#include "../lib/hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+void usage(void) {
+        printf("usage: bench-resize [N_KEYS]\n");
+}
+
+
+double now(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+int compare(const void* a, const void* b) {
+        double x = *(const double*) a;
+        double y = *(const double*) b;
+
+        return (x > y) - (x < y);
+}
+
+
+void measure(const char* name, int incremental, long n_keys) {
+        HashTable* ht;
+        double* latency;
+        double start;
+        char key[32];
+        long i;
+
+        ht = create_hash_table(16, 1);
+        latency = malloc(n_keys * sizeof(double));
+        if (ht == NULL || latency == NULL) {
+                perror("Errore allocazione");
+                exit(3);
+        }
+        hash_set_incremental_resize(ht, incremental);
+
+        for (i = 0; i < n_keys; i++) {
+                sprintf(key, "key-%ld", i);
+                start = now();
+                hash_insert(ht, key, "1");
+                latency[i] = now() - start;
+        }
+
+        qsort(latency, n_keys, sizeof(double), compare);
+        printf("%-12s\t %8.2f\t %8.2f\t %8.2f\t %10.2f\n",
+               name,
+               latency[n_keys / 2],
+               latency[n_keys * 99 / 100],
+               latency[n_keys * 999 / 1000],
+               latency[n_keys - 1]);
+
+        destroy_hash_table(ht);
+        free(latency);
+}
+
+
+int main(int argc, char** argv) {
+        long n_keys;
+
+        if (argc != 2) {
+                usage();
+                exit(1);
+        }
+
+        n_keys = strtol(argv[1], NULL, 10);
+        if (n_keys < 1000) {
+                usage();
+                perror("Numero di chiavi troppo piccolo");
+                exit(2);
+        }
+
+        printf("mode\t\t p50 us\t\t p99 us\t\t p99.9 us\t max us\n");
+        measure("stop-world", 0, n_keys);
+        measure("incremental", 1, n_keys);
+
+        return 0;
+}
@@ -0,0 +1,124 @@
+/*
+   Questo programma misura la scalabilità della HashTable al crescere del
+   numero di thread, confrontando la tabella con un solo lock (1 shard)
+   con quella suddivisa in shard. Ogni thread inserisce OPS chiavi proprie
+   e ne rilegge altrettante; per ogni numero di thread da 1 a N_THREADS
+   viene stampato il numero di operazioni al secondo delle due tabelle.
+   Devono essere forniti i seguenti parametri in fase d'invocazione:
+   - N_THREADS: numero massimo di thread
+   - N_SHARDS: numero di shard della tabella suddivisa
+   - OPS: numero di inserimenti per thread (opzionale, default 200000)
+*/
+
+#include "../lib/hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+struct worker {
+        HashTable* ht;
+        int id;
+        long ops;
+};
+
+
+void usage(void) {
+        printf("usage: bench-shards [N_THREADS] [N_SHARDS] [OPS]\n");
+}
+
+
+double now(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void* run(void* _args) {
+        struct worker* w = (struct worker*) _args;
+        char key[32];
+        long i;
+
+        for (i = 0; i < w->ops; i++) {
+                sprintf(key, "t%d-k%ld", w->id, i);
+                hash_insert(w->ht, key, "1");
+        }
+        for (i = 0; i < w->ops; i++) {
+                sprintf(key, "t%d-k%ld", w->id, (i * 7919) % w->ops);
+                hash_get(w->ht, key);
+        }
+
+        pthread_exit(NULL);
+}
+
+
+double measure(int n_threads, size_t n_shards, long ops) {
+        struct worker* w;
+        pthread_t* thread;
+        HashTable* ht;
+        double start;
+        double elapsed;
+        int i;
+
+        ht = create_hash_table(1024, n_shards);
+        w = malloc(n_threads * sizeof(struct worker));
+        thread = malloc(n_threads * sizeof(pthread_t));
+        if (ht == NULL || w == NULL || thread == NULL) {
+                perror("Errore allocazione");
+                exit(3);
+        }
+
+        start = now();
+        for (i = 0; i < n_threads; i++) {
+                w[i].ht = ht;
+                w[i].id = i;
+                w[i].ops = ops;
+                pthread_create(&thread[i], NULL, run, (void*) &w[i]);
+        }
+        for (i = 0; i < n_threads; i++) {
+                pthread_join(thread[i], NULL);
+        }
+        elapsed = now() - start;
+
+        destroy_hash_table(ht);
+        free(thread);
+        free(w);
+
+        return 2.0 * ops * n_threads / elapsed;
+}
+
+
+int main(int argc, char** argv) {
+        int n_threads;
+        size_t n_shards;
+        long ops = 200000;
+        int i;
+
+        if (argc != 3 && argc != 4) {
+                usage();
+                exit(1);
+        }
+
+        n_threads = (int) strtol(argv[1], NULL, 10);
+        n_shards = strtol(argv[2], NULL, 10);
+        if (argc == 4) {
+                ops = strtol(argv[3], NULL, 10);
+        }
+        if (n_threads < 1 || n_shards < 1 || ops < 1) {
+                usage();
+                exit(2);
+        }
+
+        printf("threads\t single-lock ops/s\t %lu shards ops/s\n", n_shards);
+        for (i = 1; i <= n_threads; i++) {
+                printf("%d\t %.0f\t\t %.0f\n",
+                       i,
+                       measure(i, 1, ops),
+                       measure(i, n_shards, ops));
+        }
+
+        return 0;
+}
@@ -0,0 +1,615 @@
+/*
+   Questo programma esegue un carico di lavoro configurabile su una
+   HashTable e ne stampa i risultati come una riga JSON, così che più
+   esecuzioni possano essere confrontate o raccolte da uno script.
+   Vengono generate KEYS chiavi di lunghezza uniforme tra MIN e MAX byte,
+   tutte inserite prima della misura, e altrettante chiavi mai inserite
+   per le ricerche mancate; quindi OPS operazioni, divise tra i thread,
+   vengono scelte secondo le percentuali di lettura, scrittura e
+   rimozione, su chiavi scelte in modo uniforme o secondo una
+   distribuzione di Zipf. Le sequenze di operazioni vengono generate
+   prima della misura. Vengono riportati il throughput, i percentili 50,
+   99 e 99.9 della latenza (in totale e per tipo di operazione), il
+   picco di memoria residente e le statistiche di hash_stats; se la
+   libreria è compilata con HASH_TRACE (make TRACE=1) anche le misure di
+   hash_trace_snapshot raccolte durante la prova.
+   Parametri opzionali:
+   - -n NAME: nome dell'esecuzione riportato nel JSON
+   - -k KEYS: chiavi inserite prima della misura (default 1000000)
+   - -o OPS: operazioni misurate (default 2000000)
+   - -r READ, -w WRITE, -d DELETE: percentuali delle operazioni
+     (default 90, 10, 0; la somma deve essere 100)
+   - -m MISS: percentuale di letture di chiavi assenti (default 0)
+   - -z S: esponente di Zipf, 0 per chiavi uniformi (default 0)
+   - -l MIN:MAX: lunghezza delle chiavi (default 8:16)
+   - -t THREADS: thread che eseguono le operazioni (default 1)
+   - -s SHARDS: shard della HashTable (default 1)
+   - -e ENGINE: linear o swiss (default linear)
+   - -p: dimensioni potenze di due, -a: arena, -i: ridimensionamento
+     incrementale
+*/
+
+#include "../lib/hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#define OP_READ 0
+#define OP_WRITE 1
+#define OP_DELETE 2
+#define OP_TYPES 3
+
+const char* op_names[OP_TYPES] = {"read", "write", "delete"};
+
+typedef struct config {
+        const char* name;
+        size_t keys;
+        size_t ops;
+        int read;
+        int write;
+        int remove;
+        int miss;
+        double zipf;
+        size_t min_len;
+        size_t max_len;
+        size_t threads;
+        size_t shards;
+        int engine;
+        int power_of_two;
+        int arena;
+        int incremental;
+} Config;
+
+/* Chiavi generate, tutte in un unico buffer */
+typedef struct key_set {
+        char* bytes;
+        size_t* offset;
+        size_t* len;
+} KeySet;
+
+/* Operazioni di un thread: tipo, chiave (o chiave assente) e latenza */
+typedef struct worker {
+        HashTable* ht;
+        KeySet* present;
+        KeySet* absent;
+        unsigned char* type;
+        uint32_t* key;
+        unsigned char* miss;
+        uint32_t* latency;
+        size_t n;
+        pthread_barrier_t* barrier;
+} Worker;
+
+
+void usage(void) {
+        printf("usage: bench [-n NAME] [-k KEYS] [-o OPS] [-r READ] "
+               "[-w WRITE] [-d DELETE] [-m MISS] [-z S] [-l MIN:MAX] "
+               "[-t THREADS] [-s SHARDS] [-e linear|swiss] [-p] [-a] "
+               "[-i]\n");
+}
+
+
+double now(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static inline
+uint64_t now_ns(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+
+/*
+ * Generatore pseudo-casuale xorshift64*, uno stato per sequenza.
+ */
+static inline
+uint64_t next_random(uint64_t* state) {
+        *state ^= *state >> 12;
+        *state ^= *state << 25;
+        *state ^= *state >> 27;
+        return *state * 0x2545f4914f6cdd1dUL;
+}
+
+
+/*
+ * Genera n chiavi distinte che iniziano con prefix: il prefisso, l'indice
+ * in esadecimale e, se la lunghezza estratta lo consente, un trattino
+ * seguito da lettere. Il trattino separa l'indice dal riempimento, per
+ * cui chiavi di indici diversi non coincidono mai.
+ */
+void generate_keys(KeySet* set, size_t n, char prefix, Config* cfg,
+                   uint64_t seed) {
+        char head[32];
+        size_t head_len, len, total = 0;
+        size_t i, j;
+
+        set->offset = malloc(n * sizeof(size_t));
+        set->len = malloc(n * sizeof(size_t));
+        if (set->offset == NULL || set->len == NULL) {
+                perror("Errore allocazione");
+                exit(3);
+        }
+        for (i = 0; i < n; i++) {
+                head_len = sprintf(head, "%c%lx", prefix, i);
+                len = cfg->min_len + next_random(&seed) %
+                      (cfg->max_len - cfg->min_len + 1);
+                set->len[i] = len > head_len ? len : head_len;
+                set->offset[i] = total;
+                total += set->len[i] + 1;
+        }
+
+        set->bytes = malloc(total);
+        if (set->bytes == NULL) {
+                perror("Errore allocazione");
+                exit(3);
+        }
+        for (i = 0; i < n; i++) {
+                head_len = sprintf(set->bytes + set->offset[i], "%c%lx",
+                                   prefix, i);
+                if (set->len[i] > head_len) {
+                        set->bytes[set->offset[i] + head_len] = '-';
+                }
+                for (j = head_len + 1; j < set->len[i]; j++) {
+                        set->bytes[set->offset[i] + j] = 'a' + (i + j) % 26;
+                }
+                set->bytes[set->offset[i] + set->len[i]] = '\0';
+        }
+}
+
+
+void free_keys(KeySet* set) {
+        free(set->bytes);
+        free(set->offset);
+        free(set->len);
+}
+
+
+/*
+ * Prepara le funzioni per scegliere le chiavi: con la distribuzione di
+ * Zipf la chiave di rango r (da 0) ha probabilità proporzionale a
+ * 1 / (r + 1)^s; cdf ne contiene la funzione di ripartizione e rank la
+ * chiave corrispondente a ogni rango, in ordine casuale così che le
+ * chiavi più frequenti non siano vicine nella tabella.
+ */
+double* zipf_cdf(size_t n, double s) {
+        double* cdf;
+        double sum = 0;
+        size_t i;
+
+        cdf = malloc(n * sizeof(double));
+        if (cdf == NULL) {
+                perror("Errore allocazione");
+                exit(3);
+        }
+        for (i = 0; i < n; i++) {
+                sum += 1.0 / pow((double) (i + 1), s);
+                cdf[i] = sum;
+        }
+        for (i = 0; i < n; i++) {
+                cdf[i] /= sum;
+        }
+        return cdf;
+}
+
+
+size_t zipf_rank(double* cdf, size_t n, double u) {
+        size_t lo = 0;
+        size_t hi = n - 1;
+        size_t mid;
+
+        while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                if (cdf[mid] < u) {
+                        lo = mid + 1;
+                } else {
+                        hi = mid;
+                }
+        }
+        return lo;
+}
+
+
+void* run_worker(void* arg) {
+        Worker* w = arg;
+        KeySet* set;
+        uint64_t start;
+        size_t i, k;
+
+        pthread_barrier_wait(w->barrier);
+        for (i = 0; i < w->n; i++) {
+                k = w->key[i];
+                set = w->miss[i] ? w->absent : w->present;
+                start = now_ns();
+                switch (w->type[i]) {
+                case OP_READ:
+                        hash_get_n(w->ht, set->bytes + set->offset[k],
+                                   set->len[k]);
+                        break;
+                case OP_WRITE:
+                        hash_insert_n(w->ht, set->bytes + set->offset[k],
+                                      set->len[k], "1");
+                        break;
+                default:
+                        hash_remove_n(w->ht, set->bytes + set->offset[k],
+                                      set->len[k]);
+                        break;
+                }
+                w->latency[i] = now_ns() - start;
+        }
+        return NULL;
+}
+
+
+int compare_latency(const void* a, const void* b) {
+        uint32_t x = *(const uint32_t*) a;
+        uint32_t y = *(const uint32_t*) b;
+
+        return (x > y) - (x < y);
+}
+
+
+/*
+ * Ordina le n latenze e ne stampa numero e percentili come oggetto JSON.
+ */
+void print_latency(const char* name, uint32_t* latency, size_t n) {
+        qsort(latency, n, sizeof(uint32_t), compare_latency);
+        printf("\"%s\":{\"count\":%lu", name, n);
+        if (n > 0) {
+                printf(",\"p50\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u",
+                       latency[(size_t) (0.5 * (n - 1))],
+                       latency[(size_t) (0.99 * (n - 1))],
+                       latency[(size_t) (0.999 * (n - 1))],
+                       latency[n - 1]);
+        }
+        printf("}");
+}
+
+
+/*
+ * Stampa l'istogramma della differenza tra due fotografie di
+ * hash_trace_snapshot: numero di valori, media, percentili 50 e 99 (il
+ * limite superiore del loro bucket) e massimo dall'avvio.
+ */
+void print_trace(const char* name, HashTraceHistogram* before,
+                 HashTraceHistogram* after) {
+        size_t count = after->count - before->count;
+        size_t percentile[2] = {0, 0};
+        int found[2] = {0, 0};
+        double rank[2] = {0.5, 0.99};
+        size_t seen = 0;
+        size_t i, p;
+
+        for (i = 0; i < HASH_TRACE_BUCKETS; i++) {
+                seen += after->bucket[i] - before->bucket[i];
+                for (p = 0; p < 2; p++) {
+                        if (!found[p] && count > 0 &&
+                            seen >= rank[p] * count) {
+                                percentile[p] = (1UL << i) - 1;
+                                found[p] = 1;
+                        }
+                }
+        }
+        printf("\"%s\":{\"count\":%lu,\"mean\":%.1f,\"p50\":%lu,"
+               "\"p99\":%lu,\"max\":%lu}", name, count,
+               count > 0 ? (double) (after->sum - before->sum) / count : 0,
+               percentile[0], percentile[1], after->max);
+}
+
+
+void parse_args(int argc, char** argv, Config* cfg) {
+        int opt;
+
+        cfg->name = "default";
+        cfg->keys = 1000000;
+        cfg->ops = 2000000;
+        cfg->read = 90;
+        cfg->write = 10;
+        cfg->remove = 0;
+        cfg->miss = 0;
+        cfg->zipf = 0;
+        cfg->min_len = 8;
+        cfg->max_len = 16;
+        cfg->threads = 1;
+        cfg->shards = 1;
+        cfg->engine = HASH_ENGINE_LINEAR;
+        cfg->power_of_two = 0;
+        cfg->arena = 0;
+        cfg->incremental = 0;
+
+        while ((opt = getopt(argc, argv, "n:k:o:r:w:d:m:z:l:t:s:e:pai")) !=
+               -1) {
+                switch (opt) {
+                case 'n':
+                        cfg->name = optarg;
+                        break;
+                case 'k':
+                        cfg->keys = strtol(optarg, NULL, 10);
+                        break;
+                case 'o':
+                        cfg->ops = strtol(optarg, NULL, 10);
+                        break;
+                case 'r':
+                        cfg->read = strtol(optarg, NULL, 10);
+                        break;
+                case 'w':
+                        cfg->write = strtol(optarg, NULL, 10);
+                        break;
+                case 'd':
+                        cfg->remove = strtol(optarg, NULL, 10);
+                        break;
+                case 'm':
+                        cfg->miss = strtol(optarg, NULL, 10);
+                        break;
+                case 'z':
+                        cfg->zipf = strtod(optarg, NULL);
+                        break;
+                case 'l':
+                        if (sscanf(optarg, "%lu:%lu", &cfg->min_len,
+                                   &cfg->max_len) != 2) {
+                                usage();
+                                exit(2);
+                        }
+                        break;
+                case 't':
+                        cfg->threads = strtol(optarg, NULL, 10);
+                        break;
+                case 's':
+                        cfg->shards = strtol(optarg, NULL, 10);
+                        break;
+                case 'e':
+                        cfg->engine = strcmp(optarg, "swiss") == 0 ?
+                                      HASH_ENGINE_SWISS : HASH_ENGINE_LINEAR;
+                        break;
+                case 'p':
+                        cfg->power_of_two = 1;
+                        break;
+                case 'a':
+                        cfg->arena = 1;
+                        break;
+                case 'i':
+                        cfg->incremental = 1;
+                        break;
+                default:
+                        usage();
+                        exit(1);
+                }
+        }
+
+        if (cfg->keys < 1 || cfg->keys > UINT32_MAX || cfg->ops < 1 ||
+            cfg->threads < 1 || cfg->shards < 1 || cfg->read < 0 ||
+            cfg->write < 0 || cfg->remove < 0 ||
+            cfg->read + cfg->write + cfg->remove != 100 ||
+            cfg->miss < 0 || cfg->miss > 100 || cfg->zipf < 0 ||
+            cfg->min_len < 1 || cfg->min_len > cfg->max_len) {
+                usage();
+                exit(2);
+        }
+}
+
+
+int main(int argc, char** argv) {
+        Config cfg;
+        HashTable* ht;
+        HashStats stats;
+        KeySet present, absent;
+        Worker* workers;
+        pthread_t* threads;
+        pthread_barrier_t barrier;
+        struct rusage usage_info;
+        HashTrace trace_before, trace_after;
+        int traced;
+        double* cdf = NULL;
+        uint32_t* rank;
+        uint32_t* by_type[OP_TYPES];
+        size_t type_count[OP_TYPES] = {0, 0, 0};
+        uint32_t* all;
+        uint64_t seed = 1;
+        uint32_t swap;
+        size_t first, n, i, j, t, k;
+        double start, elapsed;
+        int roll;
+
+        parse_args(argc, argv, &cfg);
+
+        generate_keys(&present, cfg.keys, 'k', &cfg, 1);
+        generate_keys(&absent, cfg.keys, 'm', &cfg, 2);
+
+        // I ranghi di Zipf vengono assegnati alle chiavi in ordine casuale
+        rank = malloc(cfg.keys * sizeof(uint32_t));
+        if (rank == NULL) {
+                perror("Errore allocazione");
+                exit(3);
+        }
+        for (i = 0; i < cfg.keys; i++) {
+                rank[i] = i;
+        }
+        for (i = cfg.keys - 1; i > 0; i--) {
+                j = next_random(&seed) % (i + 1);
+                swap = rank[i];
+                rank[i] = rank[j];
+                rank[j] = swap;
+        }
+        if (cfg.zipf > 0) {
+                cdf = zipf_cdf(cfg.keys, cfg.zipf);
+        }
+
+        ht = create_hash_table(1024, cfg.shards);
+        if (ht == NULL ||
+            hash_set_engine(ht, cfg.engine) != 0 ||
+            (cfg.power_of_two && hash_set_power_of_two(ht) != 0) ||
+            hash_set_arena(ht, cfg.arena) != 0) {
+                perror("Errore creazione tabella");
+                exit(4);
+        }
+        hash_set_incremental_resize(ht, cfg.incremental);
+        for (i = 0; i < cfg.keys; i++) {
+                hash_insert_n(ht, present.bytes + present.offset[i],
+                              present.len[i], "1");
+        }
+
+        // Genero le operazioni di ogni thread prima della misura
+        workers = calloc(cfg.threads, sizeof(Worker));
+        threads = malloc(cfg.threads * sizeof(pthread_t));
+        if (workers == NULL || threads == NULL) {
+                perror("Errore allocazione");
+                exit(3);
+        }
+        pthread_barrier_init(&barrier, NULL, cfg.threads + 1);
+        for (t = 0; t < cfg.threads; t++) {
+                first = cfg.ops * t / cfg.threads;
+                n = cfg.ops * (t + 1) / cfg.threads - first;
+                workers[t].ht = ht;
+                workers[t].present = &present;
+                workers[t].absent = &absent;
+                workers[t].n = n;
+                workers[t].barrier = &barrier;
+                workers[t].type = malloc(n);
+                workers[t].key = malloc(n * sizeof(uint32_t));
+                workers[t].miss = malloc(n);
+                workers[t].latency = malloc(n * sizeof(uint32_t));
+                if (workers[t].type == NULL || workers[t].key == NULL ||
+                    workers[t].miss == NULL || workers[t].latency == NULL) {
+                        perror("Errore allocazione");
+                        exit(3);
+                }
+                seed = 0x9e3779b97f4a7c15UL * (t + 1);
+                for (i = 0; i < n; i++) {
+                        roll = next_random(&seed) % 100;
+                        workers[t].type[i] = roll < cfg.read ? OP_READ :
+                                             roll < cfg.read + cfg.write ?
+                                             OP_WRITE : OP_DELETE;
+                        if (cdf != NULL) {
+                                k = zipf_rank(cdf, cfg.keys,
+                                              (next_random(&seed) >> 11) *
+                                              0x1.0p-53);
+                        } else {
+                                k = next_random(&seed) % cfg.keys;
+                        }
+                        workers[t].key[i] = rank[k];
+                        workers[t].miss[i] =
+                                workers[t].type[i] == OP_READ &&
+                                (int) (next_random(&seed) % 100) < cfg.miss;
+                }
+        }
+
+        for (t = 0; t < cfg.threads; t++) {
+                if (pthread_create(&threads[t], NULL, run_worker,
+                                   &workers[t]) != 0) {
+                        perror("Errore creazione thread");
+                        exit(5);
+                }
+        }
+        traced = hash_trace_snapshot(&trace_before) == 0;
+        pthread_barrier_wait(&barrier);
+        start = now();
+        for (t = 0; t < cfg.threads; t++) {
+                pthread_join(threads[t], NULL);
+        }
+        elapsed = now() - start;
+        hash_trace_snapshot(&trace_after);
+
+        hash_stats(ht, &stats);
+        getrusage(RUSAGE_SELF, &usage_info);
+
+        // Raccolgo le latenze, in totale e per tipo di operazione
+        all = malloc(cfg.ops * sizeof(uint32_t));
+        for (k = 0; k < OP_TYPES; k++) {
+                by_type[k] = malloc(cfg.ops * sizeof(uint32_t));
+                if (by_type[k] == NULL) {
+                        perror("Errore allocazione");
+                        exit(3);
+                }
+        }
+        if (all == NULL) {
+                perror("Errore allocazione");
+                exit(3);
+        }
+        for (t = 0, n = 0; t < cfg.threads; t++) {
+                for (i = 0; i < workers[t].n; i++) {
+                        all[n++] = workers[t].latency[i];
+                        k = workers[t].type[i];
+                        by_type[k][type_count[k]++] = workers[t].latency[i];
+                }
+        }
+
+        printf("{\"name\":\"%s\",\"config\":{\"keys\":%lu,\"ops\":%lu,"
+               "\"read\":%d,\"write\":%d,\"delete\":%d,\"miss\":%d,"
+               "\"zipf\":%g,\"min_len\":%lu,\"max_len\":%lu,"
+               "\"threads\":%lu,\"shards\":%lu,\"engine\":\"%s\","
+               "\"power_of_two\":%d,\"arena\":%d,\"incremental\":%d},",
+               cfg.name, cfg.keys, cfg.ops, cfg.read, cfg.write,
+               cfg.remove, cfg.miss, cfg.zipf, cfg.min_len, cfg.max_len,
+               cfg.threads, cfg.shards,
+               cfg.engine == HASH_ENGINE_SWISS ? "swiss" : "linear",
+               cfg.power_of_two, cfg.arena, cfg.incremental);
+        printf("\"seconds\":%.6f,\"mops\":%.3f,\"latency_ns\":{",
+               elapsed, cfg.ops / elapsed / 1e6);
+        print_latency("all", all, n);
+        for (k = 0; k < OP_TYPES; k++) {
+                printf(",");
+                print_latency(op_names[k], by_type[k], type_count[k]);
+        }
+        printf("},\"peak_rss_kb\":%ld,", usage_info.ru_maxrss);
+        printf("\"table\":{\"capacity\":%lu,\"elements\":%lu,"
+               "\"tombstones\":%lu,\"load_factor\":%.4f,"
+               "\"mean_probe\":%.4f,\"max_probe\":%lu,"
+               "\"longest_cluster\":%lu,\"expansions\":%lu,"
+               "\"shrinks\":%lu,\"compactions\":%lu}",
+               stats.capacity, stats.elements, stats.tombstones,
+               stats.load_factor, stats.mean_probe, stats.max_probe,
+               stats.longest_cluster, stats.expansions, stats.shrinks,
+               stats.compactions);
+        if (traced) {
+                printf(",\"trace\":{");
+                print_trace("lock_wait_ns", &trace_before.lock_wait,
+                            &trace_after.lock_wait);
+                printf(",");
+                print_trace("lock_hold_ns", &trace_before.lock_hold,
+                            &trace_after.lock_hold);
+                printf(",");
+                print_trace("probes", &trace_before.probes,
+                            &trace_after.probes);
+                printf(",");
+                print_trace("alloc_ns", &trace_before.alloc,
+                            &trace_after.alloc);
+                printf(",");
+                print_trace("resize_ns", &trace_before.resize,
+                            &trace_after.resize);
+                printf("}");
+        }
+        printf("}\n");
+
+        pthread_barrier_destroy(&barrier);
+        for (t = 0; t < cfg.threads; t++) {
+                free(workers[t].type);
+                free(workers[t].key);
+                free(workers[t].miss);
+                free(workers[t].latency);
+        }
+        for (k = 0; k < OP_TYPES; k++) {
+                free(by_type[k]);
+        }
+        free(all);
+        free(workers);
+        free(threads);
+        free(rank);
+        free(cdf);
+        destroy_hash_table(ht);
+        free_keys(&present);
+        free_keys(&absent);
+
+        return 0;
+}
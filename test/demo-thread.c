@@ -1,14 +1,25 @@
-/* 
-   Questo programma utilizza una HashTable per memorizzare le occorrenze
-   delle parole presenti all'interno del file. Il funzionamento è lo stesso
-   di quello del programma demo.c, con la differenza che vengono utilizzati
-   N_THREAD per leggere dallo stesso file, e popolare la HashTable.
-   Il file viene suddiviso in N_THREAD porzioni e ogni thread legge il file
-   nel proprio intervallo. Devono essere forniti i seguenti parametri 
+/*
+   Questo programma conta le occorrenze delle parole presenti all'interno
+   del file, come demo.c, con N_THREADS thread, e confronta due modi di
+   farlo. Il file viene mappato in memoria una sola volta e suddiviso in
+   N_THREADS porzioni che terminano a fine riga, una per thread: ogni
+   parola viene passata alla HashTable come puntatore nel file mappato e
+   lunghezza, senza copie intermedie.
+   - shared: tutti i thread aggiornano la stessa HashTable con N_SHARDS
+     shard, acquisendo il lock dello shard a ogni parola
+   - local: ogni thread riempie una propria HashTable in modalità
+     thread-local, senza lock; le tabelle parziali vengono poi fuse con
+     hash_merge_all sommando i contatori
+   Per ciascuno vengono stampati i secondi di conta e di fusione, le
+   parole al secondo e le parole distinte, e i contatori delle due tabelle
+   finali vengono confrontati. Infine i thread rimuovono le parole dalla
+   tabella condivisa. Devono essere forniti i seguenti parametri
    in fase d'invocazione:
    - TABLE_SIZE: dimensione iniziale della HashTable
    - FILE: nome del file di cui effettuare la conta delle parole
    - N_THREADS: numero di thread
+   - N_SHARDS: numero di shard della HashTable condivisa (opzionale,
+     default 1)
 */
 
 #include "../lib/hash.h"
@@ -16,119 +27,248 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 struct ft
 {
-    char* file_name;
-    int start_index;
-    int end_index;
+    HashTable* ht;
+    char* start;
+    char* end;
+    size_t words;
+    int fails;
+};
+
+struct check
+{
+    HashTable* ht;
+    size_t mismatches;
 };
 
 
 void usage(void) {
-        printf("usage: demo [TABLE_SIZE] [FILE] [N_THREAD]\n");
+        printf("usage: demo-thread [TABLE_SIZE] [FILE] [N_THREADS] "
+               "[N_SHARDS]\n");
 }
 
 
-HashTable* ht;
+double now(void) {
+        struct timespec ts;
 
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-void* test_delete(void* _args) {
-        char* buffer;
-        FILE* fp;
-        size_t buffer_size = 100;
-        int read;
 
-        struct ft* fi = (struct ft*) _args;
+/*
+ * Incrementa il contatore della parola, partendo da 1 se manca: viene
+ * eseguita da hash_upsert sotto il lock, per cui nessun incremento va perso.
+ */
+void* increment(char* key, void* element, void* ctx) {
+        int counter = 0;
 
-        fp = fopen(fi->file_name, "r");
-        if (fp == NULL) {
-                perror("Errore apertura file");
-                exit(1);
+        (void) key;
+        if (element != NULL) {
+                counter = strtol(element, NULL, 10);
         }
-        fseek (fp , fi->start_index, SEEK_SET);
+        sprintf(ctx, "%d", counter + 1);
+        return ctx;
+}
+
+
+/*
+ * Somma i contatori di una parola presente in due tabelle parziali. Le
+ * fusioni avvengono su più thread, per cui ognuno scrive nel proprio
+ * buffer.
+ */
+void* sum(char* key, void* dst_element, void* src_element, void* ctx) {
+        static _Thread_local char str[32];
+
+        (void) key;
+        (void) ctx;
+        sprintf(str, "%ld", strtol(dst_element, NULL, 10) +
+                            strtol(src_element, NULL, 10));
+        return str;
+}
 
-        buffer = malloc(buffer_size * sizeof(char));
 
-        while ((read = getline(&buffer, &buffer_size, fp)) != -1) {
-                if (ftell(fp) >= fi->end_index) {
-                        break;
+void* count_words(void* _args) {
+        struct ft* fi = (struct ft*) _args;
+        char str[32];
+        char* word = fi->start;
+        char* newline;
+        size_t len;
+
+        while (word < fi->end) {
+                newline = memchr(word, '\n', fi->end - word);
+                if (newline == NULL) {
+                        newline = fi->end;
                 }
-                if (read > 0) {
-                        strtok(buffer, "\n");
-                        if (hash_get(ht, buffer) != NULL) {
-                                hash_remove(ht, buffer);
+                // La parola viene passata con la sua lunghezza, senza
+                // sostituire il carattere di a capo
+                len = newline - word;
+                if (len > 0) {
+                        // Lettura e incremento del contatore avvengono
+                        // con una sola acquisizione del lock
+                        if (hash_upsert_n(fi->ht, word, len,
+                                          increment, str) == -1) {
+                                fi->fails++;
                         }
+                        fi->words++;
                 }
+                word = newline + 1;
         }
 
-        fclose(fp);
-        free(buffer);
-        pthread_exit((void*) _args);
+        return NULL;
 }
 
 
-void* test_insert(void* _args) {
-        size_t buffer_size = 100;
-        char* buffer;
-        char str[buffer_size];
-        void* element;
-        FILE* fp;
-        int read;
-        int fails;
-        int counter;
-
+void* delete_words(void* _args) {
         struct ft* fi = (struct ft*) _args;
+        char* word = fi->start;
+        char* newline;
+        size_t len;
+
+        while (word < fi->end) {
+                newline = memchr(word, '\n', fi->end - word);
+                if (newline == NULL) {
+                        newline = fi->end;
+                }
+                len = newline - word;
+                if (len > 0) {
+                        if (hash_get_n(fi->ht, word, len) != NULL) {
+                                hash_remove_n(fi->ht, word, len);
+                        }
+                }
+                word = newline + 1;
+        }
+
+        return NULL;
+}
+
 
-        fp = fopen(fi->file_name, "r");
-        if (fp == NULL) {
+/*
+ * Mappa il file in sola lettura, caricandone subito le pagine così che
+ * entrambe le prove misurino solo la conta, e ne salva la dimensione in
+ * size.
+ */
+char* map_file(const char* path, size_t* size) {
+        struct stat st;
+        char* text;
+        int fd;
+
+        fd = open(path, O_RDONLY);
+        if (fd == -1) {
+                usage();
                 perror("Errore apertura file");
-                exit(1);
+                exit(4);
+        }
+        if (fstat(fd, &st) == -1 || st.st_size == 0) {
+                perror("File vuoto");
+                exit(4);
         }
-        fseek (fp , fi->start_index, SEEK_SET);
+        text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+                    fd, 0);
+        close(fd);
+        if (text == MAP_FAILED) {
+                perror("Errore mappatura file");
+                exit(4);
+        }
+        madvise(text, st.st_size, MADV_SEQUENTIAL);
+        *size = st.st_size;
+        return text;
+}
 
-        buffer = malloc(buffer_size * sizeof(char));
 
-        fails = 0;
-        while ((read = getline(&buffer, &buffer_size, fp)) != -1) {
-                if (ftell(fp) >= fi->end_index) {
-                        break;
+/*
+ * Suddivide il testo in n porzioni: ognuna termina dopo il primo a capo
+ * successivo alla sua quota del file, così che nessuna parola venga
+ * spezzata né contata due volte.
+ */
+void split_lines(char* text, size_t size, struct ft* ft, int n) {
+        char* cut;
+        int i;
+
+        for (i = 0; i < n; i++) {
+                ft[i].start = i == 0 ? text : ft[i - 1].end;
+                cut = text + size * (i + 1) / n;
+                if (cut < ft[i].start) {
+                        cut = ft[i].start;
                 }
-                counter = 0;
-                if (read > 0) {
-                        strtok(buffer, "\n");
-                        element = hash_get(ht, buffer);
-                        if (element != NULL) {
-                                counter = strtol(element, NULL, 10);
-                        }
-                        sprintf(str, "%d", counter + 1);
-                        if (hash_insert(ht, buffer, str) == -1) {
-                                fails++;
-                        }
+                while (cut > text && cut < text + size &&
+                       cut[-1] != '\n') {
+                        cut++;
                 }
+                ft[i].end = i == n - 1 ? text + size : cut;
         }
+}
+
 
-        fclose(fp);
-        free(buffer);
-        printf("Thread-%lu\t fails: %d\n", pthread_self(), fails);
-        pthread_exit((void*) _args);
+/*
+ * Esegue fn su ogni porzione, un thread ciascuna, e restituisce i secondi
+ * impiegati.
+ */
+double run(struct ft* ft, int n_threads, void* (*fn)(void*)) {
+        pthread_t* thread;
+        double start;
+        int i;
+
+        thread = malloc(n_threads * sizeof(pthread_t));
+        if (thread == NULL) {
+                perror("Errore allocazione pthread");
+                exit(4);
+        }
+
+        start = now();
+        for (i = 0; i < n_threads; i++) {
+                if (pthread_create(&thread[i], NULL, fn, &ft[i]) != 0) {
+                        perror("Errore creazione thread");
+                        exit(4);
+                }
+        }
+        for (i = 0; i < n_threads; i++) {
+                pthread_join(thread[i], NULL);
+        }
+
+        free(thread);
+        return now() - start;
+}
+
+
+/*
+ * Conta le parole il cui contatore manca o differisce nell'altra tabella.
+ */
+int compare(const char* key, size_t len, void* element, void* ctx) {
+        struct check* c = ctx;
+        char* other = hash_get_n(c->ht, key, len);
+
+        if (other == NULL || strcmp(other, element) != 0) {
+                c->mismatches++;
+        }
+        return 0;
 }
 
 
 int main(int argc, char** argv) {
         size_t table_size;
         int n_threads;
-        FILE* fp;
-        long size;
+        size_t n_shards;
+        size_t size;
+        char* text;
         struct ft *ft;
+        HashTable* shared;
+        HashTable** local;
+        struct check check;
+        size_t words;
+        int fails;
         int i;
-        int idx_start, idx_end, idx_n;
-        pthread_t* thread;
-        int* taskids;
-        char* retr;
+        double shared_time, local_time, merge_time;
 
 
-        if (argc != 4) {
+        if (argc != 4 && argc != 5) {
                 usage();
                 perror("Numero di parametri errato");
                 exit(1);
@@ -148,94 +288,93 @@ int main(int argc, char** argv) {
                 exit(3);
         }
 
-        fp = fopen(argv[2], "r");
-        if (fp == NULL) {
-                usage();
-                perror("Errore apertura file");
-                exit(4);
+        n_shards = 1;
+        if (argc == 5) {
+                n_shards = strtol(argv[4], NULL, 10);
         }
 
-        fseek(fp, 0L, SEEK_END);
-        size = ftell(fp);
-
-        fclose(fp);
+        text = map_file(argv[2], &size);
 
-        idx_n = (int) size / n_threads;
-
-        ft = malloc((size / n_threads) * sizeof(struct ft));
-        if (ft == NULL) {
+        ft = calloc(n_threads, sizeof(struct ft));
+        local = malloc(n_threads * sizeof(HashTable*));
+        if (ft == NULL || local == NULL) {
                 perror("Errore allocazione ft");
                 exit(5);
         }
 
-        idx_start = 0;
-        idx_end = idx_start + idx_n;
-        for (i = 0; i < n_threads; i++) {
-                ft[i].file_name = argv[2];
-                ft[i].start_index = idx_start;
-                ft[i].end_index = idx_end;
-                idx_start = idx_end + 1;
-                idx_end = idx_end + idx_n;
-                if (i == n_threads - 1) {
-                        idx_end = size;
-                }
-        }
-        
-        ht = create_hash_table(table_size);
-        if (ht == NULL) {
-                exit(3);
-        }
+        split_lines(text, size, ft, n_threads);
 
-        thread = malloc(n_threads * sizeof(pthread_t));
-        if (thread == NULL) {
-                perror("Errore allocazione pthread");
-                exit(4);
+        shared = create_hash_table(table_size, n_shards);
+        if (shared == NULL) {
+                exit(3);
         }
-        
-        taskids = malloc(n_threads * sizeof(int));
-        if (taskids == NULL) {
-                perror("Errore allocazione taskids");
-                exit(5);
+        for (i = 0; i < n_threads; i++) {
+                ft[i].ht = shared;
         }
+        shared_time = run(ft, n_threads, count_words);
 
+        // Ogni thread conta le parole nella propria tabella, senza lock
+        words = 0;
+        fails = 0;
         for (i = 0; i < n_threads; i++) {
-                taskids[i] = i;
-                
-                pthread_create(&thread[i], 
-                                NULL, 
-                                test_insert,
-                                (void*) &ft[i]);
+                local[i] = create_hash_table(table_size, 1);
+                if (local[i] == NULL) {
+                        exit(3);
+                }
+                hash_set_thread_local(local[i], 1);
+                ft[i].ht = local[i];
+                words += ft[i].words;
+                fails += ft[i].fails;
+                ft[i].words = 0;
+                ft[i].fails = 0;
         }
+        local_time = run(ft, n_threads, count_words);
 
+        merge_time = now();
+        if (hash_merge_all(local, n_threads, sum, NULL, n_threads) != 0) {
+                perror("Errore fusione");
+                exit(6);
+        }
+        merge_time = now() - merge_time;
         for (i = 0; i < n_threads; i++) {
-                pthread_join(thread[i], (void**) &retr);
+                fails += ft[i].fails;
         }
 
-        printf("\n\nsize after INSERTION: %lu\n", ht->size);
-        printf("ht->num_elements: %ld\n", ht->num_elements);
-        printf("hash_num_elements: %ld\n", hash_num_elements(ht));
+        printf("%-8s %8s %10s %10s %10s %10s %10s\n", "table", "threads",
+               "count s", "merge s", "total s", "Mwords/s", "keys");
+        printf("%-8s %8d %10.3f %10.3f %10.3f %10.2f %10lu\n", "shared",
+               n_threads, shared_time, 0.0, shared_time,
+               words / shared_time / 1e6, hash_num_elements(shared));
+        printf("%-8s %8d %10.3f %10.3f %10.3f %10.2f %10lu\n", "local",
+               n_threads, local_time, merge_time, local_time + merge_time,
+               words / (local_time + merge_time) / 1e6,
+               hash_num_elements(local[0]));
+
+        // Confronto i contatori delle due tabelle finali
+        check.ht = local[0];
+        check.mismatches = hash_num_elements(shared) !=
+                           hash_num_elements(local[0]);
+        hash_for_each_range(shared, 0, 1, compare, &check);
+        printf("fails: %d, mismatches: %lu\n", fails, check.mismatches);
+
+        printf("\n\nsize after INSERTION: %lu\n", hash_size(shared));
+        printf("hash_num_elements: %ld\n", hash_num_elements(shared));
 
         for (i = 0; i < n_threads; i++) {
-                taskids[i] = i;
-
-                pthread_create(&thread[i],
-                               NULL,
-                               test_delete,
-                               (void*) &ft[i]);
+                ft[i].ht = shared;
         }
+        run(ft, n_threads, delete_words);
+
+        printf("\n\nsize after DELETION: %lu\n", hash_size(shared));
+        printf("hash_num_elements: %ld\n", hash_num_elements(shared));
 
+        destroy_hash_table(shared);
         for (i = 0; i < n_threads; i++) {
-                pthread_join(thread[i], (void**) &retr);
+                destroy_hash_table(local[i]);
         }
-
-        printf("\n\nsize after DELETION: %lu\n", ht->size);
-        printf("ht->num_elements: %ld\n", ht->num_elements);
-        printf("hash_num_elements: %ld\n", hash_num_elements(ht));
-
-        destroy_hash_table(ht);
-        free(taskids);
+        free(local);
         free(ft);
-        free(thread);
+        munmap(text, size);
 
         return 0;
 }
@@ -38,7 +38,7 @@ int main(int argc, char* argv[]) {
                 exit(1);
         }
 
-        ht = create_hash_table(atoi(argv[1]));
+        ht = create_hash_table(atoi(argv[1]), 1);
         if (ht == NULL) {
                 usage();
                 exit(2);
@@ -73,10 +73,9 @@ int main(int argc, char* argv[]) {
                 }
         }
 
-        printf("size after INSERTION: %lu\n", ht->size);
+        printf("size after INSERTION: %lu\n", hash_size(ht));
 
         printf("insertion fails: %d\n", fails);
-        printf("ht->num_elements: %ld\n", ht->num_elements);
         printf("hash_num_elements: %ld\n", hash_num_elements(ht));
 
 
@@ -91,9 +90,8 @@ int main(int argc, char* argv[]) {
         }
 
         printf("\n\n");
-        printf("size after DELETION: %lu\n", ht->size);
+        printf("size after DELETION: %lu\n", hash_size(ht));
 
-        printf("ht->num_elements: %ld\n", ht->num_elements);
         printf("hash_num_elements: %ld\n", hash_num_elements(ht));
 
         destroy_hash_table(ht);